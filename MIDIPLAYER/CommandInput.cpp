@@ -0,0 +1,162 @@
+#include "CommandInput.h"
+
+#include <cstdint>
+#include <iostream>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#endif
+#endif
+
+namespace {
+#ifdef _WIN32
+    // The console handle is signaled by any input record. Drop the focus,
+    // mouse and key-up records in front of the first typed character so
+    // they do not wake the reader again.
+    bool consoleHasKey(HANDLE input) {
+        INPUT_RECORD record;
+        DWORD count = 0;
+        while (PeekConsoleInputW(input, &record, 1, &count) && count == 1) {
+            if (record.EventType == KEY_EVENT && record.Event.KeyEvent.bKeyDown
+                && record.Event.KeyEvent.uChar.UnicodeChar != 0) {
+                return true;
+            }
+            ReadConsoleInputW(input, &record, 1, &count);
+        }
+        return false;
+    }
+#endif
+}
+
+CommandInput::CommandInput() {
+#ifdef _WIN32
+    finished_ = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+#elif defined(__linux__)
+    finishedRead_ = finishedWrite_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+#else
+    int fds[2] = { -1, -1 };
+    if (pipe(fds) == 0) {
+        fcntl(fds[0], F_SETFL, O_NONBLOCK);
+        fcntl(fds[1], F_SETFL, O_NONBLOCK);
+    }
+    finishedRead_ = fds[0];
+    finishedWrite_ = fds[1];
+#endif
+}
+
+CommandInput::~CommandInput() {
+#ifdef _WIN32
+    if (finished_) CloseHandle(finished_);
+#else
+    if (finishedRead_ >= 0) close(finishedRead_);
+    if (finishedWrite_ >= 0 && finishedWrite_ != finishedRead_) close(finishedWrite_);
+#endif
+}
+
+void CommandInput::reset() {
+#ifdef _WIN32
+    ResetEvent(finished_);
+#else
+    uint64_t value;
+    while (read(finishedRead_, &value, sizeof(value)) > 0) {}
+#endif
+}
+
+void CommandInput::notifyFinished() {
+#ifdef _WIN32
+    SetEvent(finished_);
+#else
+    // eventfd takes exactly eight bytes, a pipe takes anything
+    const uint64_t value = 1;
+    ssize_t written = write(finishedWrite_, &value, sizeof(value));
+    (void)written;
+#endif
+}
+
+bool CommandInput::waitForCommand(std::string& line) {
+#ifdef _WIN32
+    for (;;) {
+        if (!waitForInput()) return false;
+        if (std::getline(std::cin, line)) return true;
+        // End of input: only the finished signal is left to wait for
+        std::cin.clear();
+        inputClosed_ = true;
+    }
+#else
+    // stdin is read directly: lines that stdio had buffered would be
+    // invisible to poll()
+    for (;;) {
+        size_t end = pending_.find('\n');
+        if (end != std::string::npos) {
+            line = pending_.substr(0, end);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            pending_.erase(0, end + 1);
+            return true;
+        }
+        if (!waitForInput()) return false;
+
+        char buffer[4096];
+        ssize_t count = read(STDIN_FILENO, buffer, sizeof(buffer));
+        if (count > 0) {
+            pending_.append(buffer, static_cast<size_t>(count));
+        }
+        else if (count == 0 || errno != EINTR) {
+            // End of input: a last unterminated line still counts
+            inputClosed_ = true;
+            if (!pending_.empty()) {
+                line.swap(pending_);
+                pending_.clear();
+                return true;
+            }
+        }
+    }
+#endif
+}
+
+bool CommandInput::waitForInput() {
+#ifdef _WIN32
+    // A line std::cin has already buffered would not wake the wait
+    if (!inputClosed_ && std::cin.rdbuf()->in_avail() > 0) return true;
+
+    HANDLE input = GetStdHandle(STD_INPUT_HANDLE);
+    DWORD mode;
+    bool console = GetConsoleMode(input, &mode) != 0;
+    for (;;) {
+        if (inputClosed_) {
+            WaitForSingleObject(finished_, INFINITE);
+            return false;
+        }
+        if (console) {
+            // The event comes first, so it wins when both are signaled
+            HANDLE handles[2] = { finished_, input };
+            DWORD result = WaitForMultipleObjects(2, handles, FALSE, INFINITE);
+            if (result == WAIT_OBJECT_0) return false;
+            if (result == WAIT_OBJECT_0 + 1 && consoleHasKey(input)) return true;
+            if (result == WAIT_FAILED) inputClosed_ = true;
+        }
+        else {
+            // Pipes and files cannot be waited on together with an event
+            if (WaitForSingleObject(finished_, 100) == WAIT_OBJECT_0) return false;
+            DWORD available = 0;
+            if (!PeekNamedPipe(input, nullptr, 0, nullptr, &available, nullptr) || available > 0) return true;
+        }
+    }
+#else
+    pollfd fds[2] = { { finishedRead_, POLLIN, 0 }, { STDIN_FILENO, POLLIN, 0 } };
+    for (;;) {
+        if (poll(fds, inputClosed_ ? 1 : 2, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (fds[0].revents) return false;
+        // Readable or hung up; getline tells which
+        if (fds[1].revents) return true;
+    }
+#endif
+}
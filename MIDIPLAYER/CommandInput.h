@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+
+// Reads command lines from the console while playback runs. The reading
+// thread sleeps until the console has input or playback signals that it
+// finished, whichever comes first, so a command is read as soon as it is
+// typed and the thread costs nothing while idle. On Windows it waits on
+// the console input handle and an event; elsewhere it polls stdin together
+// with an eventfd (a pipe where there is no eventfd).
+//
+// On Windows, once the first key of a line has been typed the rest is read
+// with std::getline, so finishing playback is noticed after Enter. On other
+// systems stdin is read without std::cin; text typed after a command stays
+// here until the next call.
+class CommandInput {
+public:
+    CommandInput();
+    ~CommandInput();
+
+    CommandInput(const CommandInput&) = delete;
+    CommandInput& operator=(const CommandInput&) = delete;
+
+    // Clear the finished signal before the next playback
+    void reset();
+
+    // Wake the reader. Any thread may call it.
+    void notifyFinished();
+
+    // Blocks until a line is entered (returns true) or notifyFinished() is
+    // called (returns false). Once stdin is closed only the latter is left.
+    bool waitForCommand(std::string& line);
+
+private:
+    bool waitForInput();
+
+    bool inputClosed_ = false;
+#ifndef _WIN32
+    std::string pending_;
+#endif
+#ifdef _WIN32
+    void* finished_;    // Event HANDLE; void* keeps windows.h out of this header
+#else
+    int finishedRead_;
+    int finishedWrite_;
+#endif
+};
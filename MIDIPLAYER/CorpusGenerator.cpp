@@ -0,0 +1,121 @@
+#include "CorpusGenerator.h"
+
+#include <algorithm>
+#include <queue>
+#include <random>
+#include "SmfWriter.h"
+
+namespace {
+    // Uniform in [0, 1) from the top 24 bits of one draw
+    double unit(std::mt19937& random) {
+        return (random() >> 8) / 16777216.0;
+    }
+
+    struct NoteOff {
+        int tick;
+        unsigned char key;
+        bool operator>(const NoteOff& other) const { return tick > other.tick; }
+    };
+}
+
+CorpusGenerator::CorpusGenerator(const CorpusSettings& settings)
+    : settings_(settings) {
+    if (settings_.tracks < 1) settings_.tracks = 1;
+    if (settings_.tracks > 65535) settings_.tracks = 65535;
+    if (settings_.seconds < 0.0) settings_.seconds = 0.0;
+    if (settings_.tempoChanges < 0) settings_.tempoChanges = 0;
+
+    // The tempo map has its own stream so changing the tracks keeps the tempos
+    std::mt19937 random(settings_.seed);
+    int segments = settings_.tempoChanges + 1;
+    double segmentSeconds = settings_.seconds / segments;
+    double tick = 0.0;
+    for (int i = 0; i < segments; i++) {
+        uint32_t bpm = 80 + random() % 121;
+        TempoSegment segment;
+        segment.startSeconds = i * segmentSeconds;
+        segment.startTick = tick;
+        segment.ticksPerSecond = kTicksPerQuarterNote * bpm / 60.0;
+        segment.microsPerQuarter = 60000000 / bpm;
+        tempoMap_.push_back(segment);
+        tick += segmentSeconds * segment.ticksPerSecond;
+    }
+}
+
+bool CorpusGenerator::write(const std::string& path) {
+    SmfWriter writer;
+    if (!writer.open(path, kTicksPerQuarterNote, settings_.tracks + 1)) return false;
+    notes_ = 0;
+    sysex_ = 0;
+
+    // Conductor track: the tempo map with the SysEx messages in between
+    std::mt19937 random(settings_.seed ^ 0x5EEDu);
+    double sysexInterval = settings_.sysexPerSecond > 0.0 ? 1.0 / settings_.sysexPerSecond : 0.0;
+    double nextSysex = sysexInterval > 0.0 ? sysexInterval / 2 : settings_.seconds;
+    size_t nextTempo = 0;
+    std::vector<unsigned char> sysex;
+    while (nextTempo < tempoMap_.size() || nextSysex < settings_.seconds) {
+        if (nextTempo < tempoMap_.size() && tempoMap_[nextTempo].startSeconds <= nextSysex) {
+            uint32_t mpq = tempoMap_[nextTempo].microsPerQuarter;
+            const unsigned char tempo[3] = {
+                static_cast<unsigned char>(mpq >> 16), static_cast<unsigned char>(mpq >> 8), static_cast<unsigned char>(mpq) };
+            writer.writeMeta(toTick(tempoMap_[nextTempo].startSeconds), 0x51, tempo, sizeof(tempo));
+            nextTempo++;
+            continue;
+        }
+
+        // Non-commercial manufacturer ID, no synth acts on it
+        sysex.assign(8 + random() % 57, 0);
+        sysex.front() = 0xF0;
+        sysex[1] = 0x7D;
+        for (size_t i = 2; i + 1 < sysex.size(); i++) sysex[i] = random() & 0x7F;
+        sysex.back() = 0xF7;
+        writer.writeEvent(toTick(nextSysex), sysex.data(), sysex.size());
+        sysex_++;
+        nextSysex += sysexInterval;
+    }
+
+    double interval = settings_.nps > 0.0 ? settings_.tracks / settings_.nps : settings_.seconds + 1.0;
+    for (int track = 0; track < settings_.tracks; track++) {
+        writer.nextTrack();
+        random.seed(settings_.seed + 0x9E3779B9u * static_cast<uint32_t>(track + 1));
+        unsigned char channel = static_cast<unsigned char>(track % 16);
+
+        std::priority_queue<NoteOff, std::vector<NoteOff>, std::greater<NoteOff>> noteOffs;
+        auto releaseUntil = [&](int tick) {
+            while (!noteOffs.empty() && noteOffs.top().tick <= tick) {
+                const unsigned char off[3] = { static_cast<unsigned char>(0x80 | channel), noteOffs.top().key, 0 };
+                writer.writeEvent(noteOffs.top().tick, off, sizeof(off));
+                noteOffs.pop();
+            }
+        };
+
+        // One note in every interval, somewhere inside it
+        for (uint64_t slot = 0;; slot++) {
+            double seconds = (slot + unit(random)) * interval;
+            if (seconds >= settings_.seconds) break;
+
+            int tick = toTick(seconds);
+            releaseUntil(tick);
+
+            unsigned char key = static_cast<unsigned char>(21 + random() % 88);
+            unsigned char velocity = static_cast<unsigned char>(1 + random() % 127);
+            const unsigned char on[3] = { static_cast<unsigned char>(0x90 | channel), key, velocity };
+            writer.writeEvent(tick, on, sizeof(on));
+            notes_++;
+
+            double length = 0.02 + unit(random) * 0.18;
+            noteOffs.push({ toTick(seconds + length), key });
+        }
+        releaseUntil(INT32_MAX);
+    }
+
+    return writer.close();
+}
+
+int CorpusGenerator::toTick(double seconds) const {
+    auto next = std::upper_bound(tempoMap_.begin(), tempoMap_.end(), seconds,
+        [](double value, const TempoSegment& segment) { return value < segment.startSeconds; });
+    const TempoSegment& segment = next == tempoMap_.begin() ? tempoMap_.front() : *(next - 1);
+    return static_cast<int>(segment.startTick + (seconds - segment.startSeconds) * segment.ticksPerSecond);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct CorpusSettings {
+    // Note tracks; the file has one more, the conductor track
+    int tracks = 16;
+    // Note-ons per second over all tracks, whatever the tempo
+    double nps = 10000.0;
+    double seconds = 60.0;
+    // Tempo changes spread evenly over the file, each to a random BPM
+    int tempoChanges = 8;
+    // SysEx messages per second in the conductor track
+    double sysexPerSecond = 0.0;
+    uint32_t seed = 1;
+};
+
+// Writes synthetic black MIDI files to benchmark the player with. The same
+// settings and seed always give the same file, on every platform: the
+// random numbers come straight from std::mt19937, whose sequence the
+// standard fixes, and not from the distributions, whose output it does not.
+//
+// Each note track plays on channel track % 16 at an even rate with some
+// jitter. Notes last 20 to 200 ms and are placed by seconds through the
+// tempo map, so tempo changes move the ticks but not the NPS.
+class CorpusGenerator {
+public:
+    static constexpr int kTicksPerQuarterNote = 960;
+
+    explicit CorpusGenerator(const CorpusSettings& settings);
+
+    // Returns false if the file cannot be written
+    bool write(const std::string& path);
+
+    uint64_t getNoteCount() const { return notes_; }
+    uint64_t getSysexCount() const { return sysex_; }
+
+private:
+    struct TempoSegment {
+        double startSeconds;
+        double startTick;
+        double ticksPerSecond;
+        uint32_t microsPerQuarter;
+    };
+
+    int toTick(double seconds) const;
+
+    CorpusSettings settings_;
+    std::vector<TempoSegment> tempoMap_;
+    uint64_t notes_ = 0;
+    uint64_t sysex_ = 0;
+};
@@ -0,0 +1,76 @@
+#include "LatencyHistogram.h"
+
+void LatencyHistogram::record(int64_t nanoseconds) {
+    uint64_t value = nanoseconds > 0 ? static_cast<uint64_t>(nanoseconds) : 0;
+    if (value >= kMaxValue) value = kMaxValue - 1;
+
+    // Single writer: a load and a store are enough, no locked instructions
+    std::atomic<uint64_t>& bucket = buckets_[indexOf(value)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    total_.store(total_.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    if (nanoseconds > max_.load(std::memory_order_relaxed)) {
+        max_.store(nanoseconds, std::memory_order_relaxed);
+    }
+    count_.store(count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets_) bucket.store(0, std::memory_order_relaxed);
+    count_.store(0, std::memory_order_relaxed);
+    total_.store(0, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+double LatencyHistogram::getMean() const {
+    uint64_t count = getCount();
+    return count ? static_cast<double>(total_.load(std::memory_order_relaxed)) / count : 0.0;
+}
+
+int64_t LatencyHistogram::getPercentile(double percent) const {
+    if (percent >= 100.0) return getMax();
+    uint64_t count = 0;
+    for (const auto& bucket : buckets_) count += bucket.load(std::memory_order_relaxed);
+    if (count == 0) return 0;
+
+    uint64_t target = static_cast<uint64_t>(count * percent / 100.0 + 0.5);
+    if (target < 1) target = 1;
+    if (target > count) target = count;
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; i++) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            int64_t value = static_cast<int64_t>(highestValueAt(i));
+            int64_t max = getMax();
+            return value < max ? value : max;
+        }
+    }
+    return getMax();
+}
+
+uint64_t LatencyHistogram::getCountAbove(int64_t nanoseconds) const {
+    if (nanoseconds < 0) return getCount();
+    uint64_t threshold = static_cast<uint64_t>(nanoseconds);
+    if (threshold >= kMaxValue) return 0;
+
+    uint64_t above = 0;
+    for (size_t i = indexOf(threshold) + 1; i < kBucketCount; i++) {
+        above += buckets_[i].load(std::memory_order_relaxed);
+    }
+    return above;
+}
+
+size_t LatencyHistogram::indexOf(uint64_t value) {
+    if (value < kSubBuckets) return static_cast<size_t>(value);
+    int shift = 1;
+    while ((value >> shift) >= kSubBuckets) shift++;
+    return static_cast<size_t>(kSubBuckets + (shift - 1) * kHalfSubBuckets + ((value >> shift) - kHalfSubBuckets));
+}
+
+uint64_t LatencyHistogram::highestValueAt(size_t index) {
+    if (index < kSubBuckets) return index;
+    uint64_t offset = index - kSubBuckets;
+    int shift = static_cast<int>(offset / kHalfSubBuckets) + 1;
+    uint64_t subBucket = offset % kHalfSubBuckets + kHalfSubBuckets;
+    return ((subBucket + 1) << shift) - 1;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Log-linear histogram of durations in nanoseconds, in the style of
+// HdrHistogram: values below 128 ns are exact, above that every power of
+// two is split into 64 buckets, so any recorded value is known to within
+// 1.6%. Values above kMaxValue land in the last bucket. Counts are plain
+// relaxed atomics written by one thread, so recording never locks and any
+// thread can read percentiles while recording goes on.
+class LatencyHistogram {
+public:
+    static constexpr uint64_t kMaxValue = 1ULL << 40; // about 18 minutes
+
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // Only one thread may record into a histogram
+    void record(int64_t nanoseconds);
+
+    // Not safe while another thread is recording
+    void reset();
+
+    uint64_t getCount() const { return count_.load(std::memory_order_relaxed); }
+    int64_t getMax() const { return max_.load(std::memory_order_relaxed); }
+    double getMean() const;
+
+    // Smallest value that percent of the recorded values do not exceed
+    int64_t getPercentile(double percent) const;
+
+    // Number of recorded values greater than the threshold
+    uint64_t getCountAbove(int64_t nanoseconds) const;
+
+private:
+    static constexpr int kSubBucketBits = 7;
+    static constexpr uint64_t kSubBuckets = 1ULL << kSubBucketBits;
+    static constexpr uint64_t kHalfSubBuckets = kSubBuckets / 2;
+    static constexpr size_t kBucketCount = kSubBuckets + (40 - kSubBucketBits) * kHalfSubBuckets;
+
+    static size_t indexOf(uint64_t value);
+    // Largest value that maps to the bucket
+    static uint64_t highestValueAt(size_t index);
+
+    std::atomic<uint64_t> buckets_[kBucketCount] = {};
+    std::atomic<uint64_t> count_{ 0 };
+    std::atomic<uint64_t> total_{ 0 };
+    std::atomic<int64_t> max_{ 0 };
+};
@@ -0,0 +1,98 @@
+#include "LoopbackBench.h"
+
+#include <chrono>
+#include <thread>
+
+namespace {
+    const char* const kVirtualPortName = "MIDIPLAYER Loopback";
+
+    long long steadyNanoseconds() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
+LoopbackBench::LoopbackBench(const LoopbackSettings& settings)
+    : settings_(settings), sendTimes_(new std::atomic<long long>[kSequenceMask + 1]) {
+    if (settings_.rate <= 0.0) settings_.rate = 1000.0;
+    if (settings_.burst == 0) settings_.burst = 1;
+    for (unsigned int i = 0; i <= kSequenceMask; i++) sendTimes_[i].store(0, std::memory_order_relaxed);
+}
+
+bool LoopbackBench::run() {
+    RtMidiOut midiOut(settings_.api, kVirtualPortName);
+    RtMidiIn midiIn(settings_.api, "MIDIPLAYER Loopback Input", 1 << 16);
+
+    if (settings_.outputPort < 0) {
+        midiOut.openVirtualPort(kVirtualPortName);
+        outputName_ = kVirtualPortName;
+    }
+    else {
+        midiOut.openPort(settings_.outputPort);
+        outputName_ = midiOut.getPortName(settings_.outputPort);
+    }
+
+    int inputPort = settings_.inputPort;
+    if (inputPort < 0) {
+        for (unsigned int i = 0; i < midiIn.getPortCount(); i++) {
+            if (midiIn.getPortName(i).find(kVirtualPortName) != std::string::npos) {
+                inputPort = static_cast<int>(i);
+                break;
+            }
+        }
+    }
+    if (inputPort < 0 || static_cast<unsigned int>(inputPort) >= midiIn.getPortCount()) return false;
+    inputName_ = midiIn.getPortName(inputPort);
+
+    midiIn.setDeferredDispatch(settings_.deferredDispatch);
+    midiIn.setTimedCallback(onProbe, this);
+    midiIn.openPort(inputPort);
+    // Give the connection a moment before the first probe
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    auto interval = std::chrono::duration<double>(settings_.burst / settings_.rate);
+    auto start = std::chrono::steady_clock::now();
+    unsigned char probe[3];
+    for (uint64_t tick = 0; sent_ < settings_.count; tick++) {
+        std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(interval * static_cast<double>(tick)));
+        for (unsigned int i = 0; i < settings_.burst && sent_ < settings_.count; i++) {
+            unsigned int sequence = static_cast<unsigned int>(sent_) & kSequenceMask;
+            probe[0] = static_cast<unsigned char>(0xA0 | (sequence >> 14));
+            probe[1] = static_cast<unsigned char>((sequence >> 7) & 0x7F);
+            probe[2] = static_cast<unsigned char>(sequence & 0x7F);
+            sendTimes_[sequence].store(steadyNanoseconds(), std::memory_order_release);
+            midiOut.sendMessage(probe, sizeof(probe));
+            sent_++;
+        }
+    }
+
+    // Stragglers: stop once everything arrived or nothing came for a second
+    uint64_t lastReceived = received_.load();
+    auto lastProgress = std::chrono::steady_clock::now();
+    while (received_.load() < sent_ && std::chrono::steady_clock::now() - lastProgress < std::chrono::seconds(1)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (received_.load() != lastReceived) {
+            lastReceived = received_.load();
+            lastProgress = std::chrono::steady_clock::now();
+        }
+    }
+
+    midiIn.closePort();
+    midiOut.closePort();
+    return true;
+}
+
+void LoopbackBench::onProbe(long long /*time*/, std::vector<unsigned char>* message, void* userData) {
+    long long now = steadyNanoseconds();
+    LoopbackBench* bench = static_cast<LoopbackBench*>(userData);
+    if (message->size() != 3 || ((*message)[0] & 0xF0) != 0xA0) return;
+
+    unsigned int sequence = (((*message)[0] & 0x0F) << 14) | ((*message)[1] << 7) | (*message)[2];
+    uint64_t received = bench->received_.load(std::memory_order_relaxed);
+    if (received > 0 && ((sequence - bench->lastSequence_) & kSequenceMask) != 1) {
+        bench->outOfSequence_.fetch_add(1, std::memory_order_relaxed);
+    }
+    bench->lastSequence_ = sequence;
+    bench->latency_.record(now - bench->sendTimes_[sequence].load(std::memory_order_acquire));
+    bench->received_.store(received + 1, std::memory_order_relaxed);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "RtMidi.h"
+#include "LatencyHistogram.h"
+
+struct LoopbackSettings {
+    RtMidi::Api api = RtMidi::UNSPECIFIED;
+    // -1 opens a virtual output and listens on the input port that leads to it
+    int outputPort = -1;
+    int inputPort = -1;
+    // Probes per second, and how many are sent back to back at each tick
+    double rate = 1000.0;
+    unsigned int burst = 1;
+    unsigned int count = 10000;
+    // Deliver input from a dispatcher thread (JACK only)
+    bool deferredDispatch = false;
+};
+
+// Measures how long RtMidi takes from sendMessage() on an output to the
+// input callback on a port connected to it. Every probe is a polyphonic
+// aftertouch message whose channel, key and value carry an 18-bit
+// sequence number, so the receiver can look up when it was sent and
+// count lost probes and probes that arrive out of sequence.
+class LoopbackBench {
+public:
+    explicit LoopbackBench(const LoopbackSettings& settings);
+
+    // Send all probes and wait for the stragglers. Throws RtMidiError if a
+    // port cannot be opened; returns false if no input port was found.
+    bool run();
+
+    const LatencyHistogram& latency() const { return latency_; }
+    uint64_t getSent() const { return sent_; }
+    uint64_t getReceived() const { return received_.load(); }
+    uint64_t getOutOfSequence() const { return outOfSequence_.load(); }
+    const std::string& getOutputName() const { return outputName_; }
+    const std::string& getInputName() const { return inputName_; }
+
+private:
+    static constexpr unsigned int kSequenceBits = 18;
+    static constexpr unsigned int kSequenceMask = (1u << kSequenceBits) - 1;
+
+    static void onProbe(long long time, std::vector<unsigned char>* message, void* userData);
+
+    LoopbackSettings settings_;
+    std::unique_ptr<std::atomic<long long>[]> sendTimes_;
+    LatencyHistogram latency_;
+    uint64_t sent_ = 0;
+    std::atomic<uint64_t> received_{ 0 };
+    std::atomic<uint64_t> outOfSequence_{ 0 };
+    unsigned int lastSequence_ = 0;
+    std::string outputName_;
+    std::string inputName_;
+};
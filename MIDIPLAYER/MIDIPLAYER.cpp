@@ -16,8 +16,26 @@
 #include <array>
 #include <condition_variable>
 #include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
 #include <conio.h>
 #include "RtMidi.h"
+#include "OutputRouter.h"
+#include "NoteCuller.h"
+#include "SmfWriter.h"
+#include "OfflineRenderer.h"
+#include "MidiRecorder.h"
+#include "LoopbackBench.h"
+#include "SendBench.h"
+#include "LatencyHistogram.h"
+#include "PlaybackStats.h"
+#include "TrafficCounters.h"
+#include "Tracer.h"
+#include "CorpusGenerator.h"
+#include "ProcessMemory.h"
+#include "MemoryAccounting.h"
+#include "CommandInput.h"
 #include "MidiFile.h"
 #ifdef _WIN32
 #include <windows.h>
@@ -32,17 +50,35 @@ std::atomic<bool> isMidiLoaded(false);
 std::atomic<bool> isPlaybackFinished(false);
 std::atomic<int> globalTranspose(0);
 std::atomic<double> globalVolumeFactor(1.0);
+std::atomic<bool> globalCullRetriggers(false);
+std::atomic<double> globalMaxNps(0.0);
+std::atomic<bool> globalCullPerChannel(false);
 std::condition_variable cv;
 std::condition_variable loadCv;
 std::mutex mtx;
-std::atomic<int> globalNoteCount(0);
-std::atomic<double> currentPlaybackTime(0.0);
+std::atomic<int> globalStatsRefreshMs(250);
+std::atomic<bool> globalTrackCounters(false);
+TrafficCounters trafficCounters;
+CommandInput commandInput;
+
+// Shown when playback starts and again after every command
+const char* const kCommandPrompt =
+    "Commands (pause/resume/stop/transpose [value]/volume [value]/bandwidth [value]/route [channel|track] [index] [port]"
+    "/cull [retrigger|nps|off] [value]/refresh [ms]/counters [tracks on|off|save path]): ";
 
 void SetColor(WORD color) {
     HANDLE hConsole = GetStdHandle(STD_OUTPUT_HANDLE);
     SetConsoleTextAttribute(hConsole, color);
 }
 
+CullSettings currentCullSettings() {
+    CullSettings settings;
+    settings.removeRetriggers = globalCullRetriggers.load();
+    settings.maxNps = globalMaxNps.load();
+    settings.perChannel = globalCullPerChannel.load();
+    return settings;
+}
+
 std::string cleanVersionString(const std::string& version) {
     std::string cleaned = version;
     cleaned.erase(std::remove_if(cleaned.begin(), cleaned.end(), [](unsigned char c) {
@@ -161,78 +197,101 @@ std::string openMidiFileDialog() {
     return "";
 }
 
-void playMidiFile(const std::string& filePath, RtMidiOut& midiOut) {
-    MidiFile midiFile;
+// Read a MIDI file and collect the events of all tracks sorted by time.
+// onStage is called with "read", "analyze", "link", "collect" and "sort"
+// as each finishes.
+bool loadTimeline(const std::string& filePath, MidiFile& midiFile, std::vector<const MidiEvent*>& allEvents,
+    const std::function<void(const char*)>& onStage = nullptr) {
     if (!midiFile.read(filePath)) {
-        SetColor(12);
-        std::cerr << "[!] Failed to load MIDI file.\n";
-        return;
+        return false;
     }
+    if (onStage) onStage("read");
 
     midiFile.doTimeAnalysis();
+    if (onStage) onStage("analyze");
     midiFile.linkNotePairs();
+    if (onStage) onStage("link");
 
-    std::vector<const MidiEvent*> allEvents;
     for (int track = 0; track < midiFile.getTrackCount(); track++) {
         for (int j = 0; j < midiFile[track].size(); j++) {
             allEvents.push_back(&midiFile[track][j]);
         }
     }
+    if (onStage) onStage("collect");
 
     std::sort(allEvents.begin(), allEvents.end(), [](const MidiEvent* a, const MidiEvent* b) {
         return a->seconds < b->seconds;
         });
+    if (onStage) onStage("sort");
+    return true;
+}
 
-    double totalDuration = allEvents.empty() ? 0.0 : allEvents.back()->seconds;
-    int totalNotes = 0;
-    int minutes = static_cast<int>(totalDuration) / 60;
-    double seconds = totalDuration - minutes * 60;
-    for (const auto& event : allEvents) {
-        if (event->isNoteOn()) totalNotes++;
+// Apply transpose, volume and online culling to a note-on or note-off.
+// Returns false when the note is culled and must not be sent.
+bool transformNoteMessage(const unsigned char* input, double seconds, NoteCuller& culler, unsigned char message[3]) {
+    unsigned char status = input[0];
+    int note = input[1];
+    int velocity = input[2];
+
+    note += globalTranspose.load();
+    if (note < 0) note = 0;
+    if (note > 127) note = 127;
+
+    if ((status & 0xF0) == 0x90 && velocity > 0) {
+        velocity = static_cast<int>(velocity * globalVolumeFactor.load());
+        if (velocity > 127) velocity = 127;
+        if (velocity < 0) velocity = 0;
     }
-    SetColor(15);
-    std::cout << "\n[ MIDI Information ]" << std::endl;
-    SetColor(11);
-    std::cout << "  Playing MIDI: " << filePath << "\n"
-        << "  Total Notes: " << totalNotes << "\n"
-        << "  Duration: " << minutes << "m "
-        << std::fixed << std::setprecision(2) << seconds << "s\n";
 
-    {
-        std::lock_guard<std::mutex> lock(mtx);
-        isMidiLoaded = true;
+    message[0] = status;
+    message[1] = static_cast<unsigned char>(note);
+    message[2] = static_cast<unsigned char>(velocity);
+
+    CullSettings cull = currentCullSettings();
+    if (cull != culler.settings()) {
+        // Changed after load, so the rest of the file is culled online
+        culler.setSettings(cull);
+        culler.setOnlineRules(cull.enabled());
     }
-    loadCv.notify_one();
+    return culler.accept(seconds, message, 3);
+}
+
+bool transformNoteEvent(const MidiEvent* event, NoteCuller& culler, unsigned char message[3]) {
+    const unsigned char input[3] = { (*event)[0], (*event)[1], (*event)[2] };
+    return transformNoteMessage(input, event->seconds, culler, message);
+}
+
+// One line per stage: heap in use at its end and at its peak, and the
+// resident set as the OS sees it
+void printMemoryReport(const MemoryReport& report) {
+    const double mebibyte = 1024.0 * 1024.0;
+    std::cout << std::fixed << std::setprecision(1);
+    for (const MemoryStage& stage : report.getStages()) {
+        std::cout << "\n[*] Memory after " << stage.name << ": heap " << stage.heapBytes / mebibyte
+            << " MiB (peak " << stage.heapPeakBytes / mebibyte << " MiB, " << stage.allocations
+            << " allocations), resident " << stage.residentBytes / mebibyte
+            << " MiB (peak " << stage.peakResidentBytes / mebibyte << " MiB)";
+    }
+}
 
+// The scheduler loop: hands every event to the router when it is due on the
+// steady clock, honouring pause and stop, and records how late it was. The
+// timeline runs speed times faster than written; at speed 0 every event is
+// due at once.
+void dispatchTimeline(const std::vector<const MidiEvent*>& allEvents, NoteCuller& culler, double speed,
+    OutputRouter& output, StatsWriter* counters, LatencyHistogram& lateness) {
     auto playbackStart = std::chrono::steady_clock::now();
     std::chrono::duration<double> pauseDuration = std::chrono::duration<double>::zero();
     std::chrono::steady_clock::time_point pauseStart{};
 
-    int noteCount = 0;
-    double lastEventTime = 0.0;
-
-    // Thread that updates console title every second
-    std::thread titleUpdater([totalDuration]() {
-        while (!isPlaybackFinished) {
-            std::this_thread::sleep_for(std::chrono::seconds(1));
-            int notes = globalNoteCount.exchange(0);
-            double cpTime = currentPlaybackTime.load();
-            double progressPercent = (cpTime / totalDuration) * 100.0;
-
-            wchar_t title[256];
-            swprintf_s(title, 256,
-                L"Progress: %.2f%% | NPS: %d | BPM: %.1f",
-                progressPercent, notes, currentBpm.load()
-            );
-            SetConsoleTitleW(title);
-        }
-        });
-
+    // Time between waits is one dispatch batch
+    TRACE_BEGIN("dispatch");
     for (const MidiEvent* event : allEvents) {
         if (isStopped) break;
 
         double eventTime = event->seconds;
-        auto targetTime = playbackStart + std::chrono::duration<double>(eventTime) + pauseDuration;
+        auto due = std::chrono::duration<double>(speed > 0.0 ? eventTime / speed : 0.0);
+        auto targetTime = playbackStart + due + pauseDuration;
 
         while (true) {
             std::unique_lock<std::mutex> lock(mtx);
@@ -242,69 +301,1008 @@ void playMidiFile(const std::string& filePath, RtMidiOut& midiOut) {
                 if (pauseStart == std::chrono::steady_clock::time_point{}) {
                     pauseStart = std::chrono::steady_clock::now();
                 }
+                TRACE_END("dispatch");
+                TRACE_BEGIN("paused");
                 cv.wait(lock, [] { return !isPaused || isStopped; });
+                TRACE_END("paused");
+                TRACE_BEGIN("dispatch");
                 if (isStopped) break;
                 auto now = std::chrono::steady_clock::now();
                 pauseDuration += now - pauseStart;
                 pauseStart = std::chrono::steady_clock::time_point{};
-                targetTime = playbackStart + std::chrono::duration<double>(eventTime) + pauseDuration;
+                targetTime = playbackStart + due + pauseDuration;
             }
             else {
                 auto now = std::chrono::steady_clock::now();
                 if (now >= targetTime) break;
+                TRACE_END("dispatch");
+                TRACE_BEGIN("wait");
                 cv.wait_until(lock, targetTime, [] { return isPaused || isStopped; });
+                TRACE_END("wait");
+                TRACE_BEGIN("dispatch");
             }
         }
 
+        lateness.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - targetTime).count());
+
         // Update playback time (for title update)
-        currentPlaybackTime.store(eventTime);
+        counters->eventDispatched(eventTime);
 
         if (event->isMeta() && (*event)[0] == 0x51) {
             int mpq = ((*event)[3] << 16) | ((*event)[4] << 8) | (*event)[5];
             currentBpm.store(60000000.0 / mpq);
         }
 
-        if (event->isNoteOn()) {
-            noteCount++;
-            globalNoteCount++;
+        if (event->isNoteOn() || event->isNoteOff()) {
+            unsigned char message[3];
+            if (!transformNoteEvent(event, culler, message)) continue;
+
+            if (event->isNoteOn()) counters->noteOn(eventTime);
+            trafficCounters.count(event->track, message, sizeof(message));
+            output.submit(event->track, message, sizeof(message));
         }
+    }
 
-        if (event->isNoteOn() || event->isNoteOff()) {
-            // Apply global transpose and volume factor
-            unsigned char status = (*event)[0];
-            int note = (*event)[1];
-            int velocity = (*event)[2];
-
-            note += globalTranspose.load();
-            if (note < 0) note = 0;
-            if (note > 127) note = 127;
-
-            if (event->isNoteOn()) {
-                velocity = static_cast<int>(velocity * globalVolumeFactor.load());
-                if (velocity > 127) velocity = 127;
-                if (velocity < 0) velocity = 0;
-            }
+    TRACE_END("dispatch");
+}
+
+void playMidiFile(const std::string& filePath, OutputRouter& output) {
+    TRACE_THREAD_NAME("scheduler");
+    MemoryReport memory;
+    MidiFile midiFile;
+    std::vector<const MidiEvent*> allEvents;
+    if (!loadTimeline(filePath, midiFile, allEvents, [&memory](const char* stage) { memory.mark(stage); })) {
+        SetColor(12);
+        std::cerr << "[!] Failed to load MIDI file.\n";
+        return;
+    }
+
+    // Cull at load time where the whole timeline is known
+    NoteCuller culler(currentCullSettings());
+    culler.cullTimeline(allEvents);
+    memory.mark("cull");
+    uint64_t culledNotes = culler.getRetriggersRemoved() + culler.getNpsShed();
+
+    double totalDuration = allEvents.empty() ? 0.0 : allEvents.back()->seconds;
+    int totalNotes = 0;
+    int minutes = static_cast<int>(totalDuration) / 60;
+    double seconds = totalDuration - minutes * 60;
+    for (const auto& event : allEvents) {
+        if (event->isNoteOn()) totalNotes++;
+    }
+    SetColor(15);
+    std::cout << "\n[ MIDI Information ]" << std::endl;
+    SetColor(11);
+    std::cout << "  Playing MIDI: " << filePath << "\n"
+        << "  Total Notes: " << totalNotes << "\n";
+    if (culledNotes > 0) {
+        std::cout << "  Culled Notes: " << culledNotes << "\n";
+    }
+    std::cout
+        << "  Duration: " << minutes << "m "
+        << std::fixed << std::setprecision(2) << seconds << "s\n";
+
+    // Cleared before the command loop can read it
+    trafficCounters.reset(globalTrackCounters ? midiFile.getTrackCount() : 0);
+
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        isMidiLoaded = true;
+    }
+    loadCv.notify_one();
+
+    // How late every event is dispatched compared to when it was due
+    LatencyHistogram lateness;
+
+    // Counters this thread publishes for the title updater
+    PlaybackStats stats;
+    StatsWriter* counters = stats.addWriter();
 
-            std::vector<unsigned char> message = {
-                static_cast<unsigned char>(status),
-                static_cast<unsigned char>(note),
-                static_cast<unsigned char>(velocity)
-            };
-            midiOut.sendMessage(&message);
+    // Thread that updates console title at the refresh rate
+    std::thread titleUpdater([totalDuration, &output, &lateness, &stats]() {
+        while (stats.waitForRefresh(std::chrono::milliseconds(globalStatsRefreshMs.load()))) {
+            StatsSnapshot snapshot = stats.snapshot();
+            double progressPercent = (snapshot.playbackTime / totalDuration) * 100.0;
+
+            // Events the output backend had to defer or discard (JACK only)
+            unsigned long long carried = output.getCarriedOverCount();
+            unsigned long long dropped = output.getDroppedCount();
+
+            wchar_t title[256];
+            swprintf_s(title, 256,
+                L"Progress: %.2f%% | NPS: %.0f | Late p99: %.2f ms | Carried: %llu | Dropped: %llu | BPM: %.1f",
+                progressPercent, snapshot.nps, lateness.getPercentile(99.0) / 1e6, carried, dropped, currentBpm.load()
+            );
+            SetConsoleTitleW(title);
         }
+        });
+
+    dispatchTimeline(allEvents, culler, 1.0, output, counters, lateness);
+    memory.mark("playback");
+
+    TRACE_BEGIN("flush");
+    if (isStopped) output.panic();
+    else output.drain();
+    TRACE_END("flush");
+
+    // Wakes the title updater at once instead of after its next refresh
+    stats.stop();
+    if (titleUpdater.joinable()) {
+        titleUpdater.join();
     }
 
     SetColor(13);
     std::cout << "\n[*] MIDI playback finished.";
+    if (culler.getRetriggersRemoved() + culler.getNpsShed() > 0) {
+        std::cout << "\n[*] Culled: " << culler.getRetriggersRemoved() << " retriggers, "
+            << culler.getNpsShed() << " over NPS ceiling, "
+            << culler.getNoteOffsRemoved() << " note-offs";
+    }
+    if (lateness.getCount() > 0) {
+        std::cout << std::fixed << std::setprecision(2)
+            << "\n[*] Scheduling lateness: p50 " << lateness.getPercentile(50.0) / 1e6
+            << " ms, p99 " << lateness.getPercentile(99.0) / 1e6
+            << " ms, max " << lateness.getMax() / 1e6 << " ms"
+            << "\n[*] Events late by more than 1 ms: " << lateness.getCountAbove(1000000)
+            << ", 5 ms: " << lateness.getCountAbove(5000000)
+            << ", 20 ms: " << lateness.getCountAbove(20000000)
+            << " (of " << lateness.getCount() << ")";
+    }
+    printMemoryReport(memory);
+    for (size_t i = 0; i < output.getPortCount(); i++) {
+        OutputShaper& shaper = output.shaper(i);
+        if (shaper.getBytesPerSecond() > 0.0) {
+            std::cout << "\n[*] Port " << i << " shaper: " << shaper.getSentCount() << " sent, "
+                << shaper.getShedCount() << " note-ons shed, "
+                << shaper.getRunningStatusSavings() << " bytes saved by running status";
+        }
+    }
+#ifdef MIDIPLAYER_TRACE
+    if (Tracer::dump("MIDIPLAYER-trace.json")) {
+        std::cout << "\n[*] Trace written to MIDIPLAYER-trace.json";
+    }
+#endif
     isPlaybackFinished = true;
     cv.notify_all();
+    commandInput.notifyFinished();
+}
 
-    if (titleUpdater.joinable()) {
-        titleUpdater.join();
+// Print the channels, and the busiest tracks, that sent anything. Rates are
+// averaged since the previous call.
+void printTrafficCounters() {
+    static LaneSnapshot previous[16];
+    static std::chrono::steady_clock::time_point previousTime;
+
+    auto now = std::chrono::steady_clock::now();
+    double elapsed = std::chrono::duration<double>(now - previousTime).count();
+    bool haveRate = previousTime != std::chrono::steady_clock::time_point{} && elapsed > 0.0;
+    previousTime = now;
+
+    SetColor(10);
+    std::cout << std::fixed << std::setprecision(1);
+    for (int i = 0; i < 16; i++) {
+        LaneSnapshot lane = trafficCounters.channel(i);
+        if (lane.bytes > 0) {
+            std::cout << "  Channel " << std::setw(2) << i + 1 << ": " << lane.noteOns << " notes, "
+                << lane.held << " held (peak " << lane.peakHeld << "), " << lane.bytes << " bytes";
+            if (haveRate && lane.bytes >= previous[i].bytes) {
+                std::cout << ", " << (lane.noteOns - previous[i].noteOns) / elapsed << " NPS, "
+                    << (lane.bytes - previous[i].bytes) / elapsed << " bytes/s";
+            }
+            std::cout << "\n";
+        }
+        previous[i] = lane;
+    }
+
+    // Only the heaviest tracks, a file can have thousands
+    std::vector<std::pair<uint64_t, size_t>> busiest;
+    for (size_t i = 0; i < trafficCounters.getTrackCount(); i++) {
+        uint64_t bytes = trafficCounters.track(i).bytes;
+        if (bytes > 0) busiest.emplace_back(bytes, i);
     }
+    size_t shown = busiest.size() < 8 ? busiest.size() : 8;
+    std::partial_sort(busiest.begin(), busiest.begin() + shown, busiest.end(),
+        [](const std::pair<uint64_t, size_t>& a, const std::pair<uint64_t, size_t>& b) { return a.first > b.first; });
+    for (size_t i = 0; i < shown; i++) {
+        LaneSnapshot lane = trafficCounters.track(busiest[i].second);
+        std::cout << "  Track " << busiest[i].second << ": " << lane.noteOns << " notes, "
+            << lane.held << " held (peak " << lane.peakHeld << "), " << lane.bytes << " bytes\n";
+    }
+}
+
+// Run the playback pipeline against a virtual clock: every event is due as
+// soon as the previous one is done, and the transformed stream is written
+// to a new MIDI file instead of a port.
+bool exportMidiFile(const std::string& inputPath, const std::string& outputPath) {
+    MidiFile midiFile;
+    std::vector<const MidiEvent*> allEvents;
+    if (!loadTimeline(inputPath, midiFile, allEvents)) {
+        SetColor(12);
+        std::cerr << "[!] Failed to load MIDI file.\n";
+        return false;
+    }
+
+    NoteCuller culler(currentCullSettings());
+    culler.cullTimeline(allEvents);
+
+    SmfWriter writer;
+    if (!writer.open(outputPath, midiFile.getTicksPerQuarterNote())) {
+        SetColor(12);
+        std::cerr << "[!] Failed to create " << outputPath << "\n";
+        return false;
+    }
+
+    auto exportStart = std::chrono::steady_clock::now();
+    double totalDuration = allEvents.empty() ? 0.0 : allEvents.back()->seconds;
+
+    for (const MidiEvent* event : allEvents) {
+        if (event->isTempo() && event->size() >= 6) {
+            // Ticks are kept from the source, so its tempo map keeps the timing
+            writer.writeMeta(event->tick, 0x51, &(*event)[3], 3);
+        }
+        else if (event->isNoteOn() || event->isNoteOff()) {
+            unsigned char message[3];
+            if (!transformNoteEvent(event, culler, message)) continue;
+            writer.writeEvent(event->tick, message, sizeof(message));
+        }
+    }
+
+    uint64_t events = writer.getEventCount();
+    uint64_t bytes = writer.getBytesWritten();
+    if (!writer.close()) {
+        SetColor(12);
+        std::cerr << "[!] Failed to write " << outputPath << "\n";
+        return false;
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - exportStart).count();
+    SetColor(15);
+    std::cout << "\n[ Export Information ]" << std::endl;
+    SetColor(11);
+    std::cout << "  Input: " << inputPath << "\n"
+        << "  Output: " << outputPath << "\n"
+        << "  Events Written: " << events << " (" << bytes << " bytes)\n";
+    if (culler.getRetriggersRemoved() + culler.getNpsShed() > 0) {
+        std::cout << "  Culled Notes: " << culler.getRetriggersRemoved() + culler.getNpsShed() << "\n";
+    }
+    std::cout << std::fixed << std::setprecision(2)
+        << "  Exported " << totalDuration << "s of music in " << elapsed << "s\n";
+    return true;
+}
+
+// Render what playback would send through the built-in synth into a WAV
+// file, for listening to or diffing output on machines without a MIDI device.
+bool renderMidiFile(const std::string& inputPath, const std::string& outputPath, const RenderSettings& settings) {
+    MidiFile midiFile;
+    std::vector<const MidiEvent*> allEvents;
+    if (!loadTimeline(inputPath, midiFile, allEvents)) {
+        SetColor(12);
+        std::cerr << "[!] Failed to load MIDI file.\n";
+        return false;
+    }
+
+    NoteCuller culler(currentCullSettings());
+    culler.cullTimeline(allEvents);
+
+    // Pair every note-on with the next note-off of its key, first in first out
+    std::vector<RenderNote> notes;
+    std::vector<std::deque<size_t>> sounding(16 * 128);
+    for (const MidiEvent* event : allEvents) {
+        if (!event->isNoteOn() && !event->isNoteOff()) continue;
+        unsigned char message[3];
+        if (!transformNoteEvent(event, culler, message)) continue;
+
+        int channel = message[0] & 0x0F;
+        std::deque<size_t>& open = sounding[channel * 128 + message[1]];
+        if ((message[0] & 0xF0) == 0x90 && message[2] > 0) {
+            open.push_back(notes.size());
+            notes.push_back({ event->seconds, event->seconds, static_cast<unsigned char>(channel), message[1], message[2] });
+        }
+        else if (!open.empty()) {
+            notes[open.front()].end = event->seconds;
+            open.pop_front();
+        }
+    }
+    double totalDuration = allEvents.empty() ? 0.0 : allEvents.back()->seconds;
+    for (auto& open : sounding) {
+        for (size_t index : open) notes[index].end = totalDuration;
+    }
+
+    OfflineRenderer renderer(settings);
+    auto renderStart = std::chrono::steady_clock::now();
+    if (!renderer.render(notes, outputPath)) {
+        SetColor(12);
+        std::cerr << "[!] Failed to write " << outputPath << "\n";
+        return false;
+    }
+
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart).count();
+    double rendered = static_cast<double>(renderer.getFramesWritten()) / settings.sampleRate;
+    SetColor(15);
+    std::cout << "\n[ Render Information ]" << std::endl;
+    SetColor(11);
+    std::cout << "  Input: " << inputPath << "\n"
+        << "  Output: " << outputPath << "\n"
+        << "  Notes Rendered: " << notes.size() << "\n"
+        << "  Threads: " << renderer.getThreadCount() << "\n"
+        << std::fixed << std::setprecision(2)
+        << "  Rendered " << rendered << "s of audio in " << elapsed << "s\n";
+    return true;
+}
+
+// Quote a string for a JSON file
+std::string jsonString(const std::string& text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') quoted += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            quoted += escaped;
+        }
+        else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
 }
 
-int main() {
+// Output of the benchmark: counts what reaches the port instead of sending it
+class CountingSink : public MidiSink {
+public:
+    void send(const unsigned char*, size_t size) override {
+        messages.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint64_t> messages{ 0 };
+    std::atomic<uint64_t> bytes{ 0 };
+};
+
+// Run load, analysis, flattening, culling and playback of a file without a
+// MIDI port and write how long every stage took to a JSON file. Playback
+// runs the same scheduler, router queue, sender thread and shaper as normal
+// playback, into a sink that only counts. At speed 0 every event is due at
+// once, which measures throughput; at any other speed the timeline is played
+// against the real clock that many times faster, and the lateness of every
+// event is recorded as in normal playback.
+bool benchmarkMidiFile(const std::string& inputPath, const std::string& jsonPath, double speed) {
+    MemoryReport memory;
+    std::vector<std::pair<std::string, double>> stages;
+    auto stageStart = std::chrono::steady_clock::now();
+    auto endStage = [&](const char* name) {
+        auto now = std::chrono::steady_clock::now();
+        stages.emplace_back(name, std::chrono::duration<double>(now - stageStart).count());
+        memory.mark(name);
+        stageStart = std::chrono::steady_clock::now();
+    };
+
+    MidiFile midiFile;
+    std::vector<const MidiEvent*> allEvents;
+    if (!loadTimeline(inputPath, midiFile, allEvents, endStage)) {
+        SetColor(12);
+        std::cerr << "[!] Failed to load MIDI file.\n";
+        return false;
+    }
+
+    NoteCuller culler(currentCullSettings());
+    culler.cullTimeline(allEvents);
+    endStage("cull");
+
+    OutputRouter output;
+    CountingSink* sink = new CountingSink;
+    output.addSink(std::unique_ptr<MidiSink>(sink), "Benchmark");
+    trafficCounters.reset(0);
+    PlaybackStats stats;
+    LatencyHistogram lateness;
+    stageStart = std::chrono::steady_clock::now();
+    dispatchTimeline(allEvents, culler, speed, output, stats.addWriter(), lateness);
+    output.drain();
+    endStage("play");
+    uint64_t messages = sink->messages.load();
+    uint64_t bytes = sink->bytes.load();
+
+    double loadSeconds = 0.0;
+    for (size_t i = 0; i + 1 < stages.size(); i++) loadSeconds += stages[i].second;
+    double playSeconds = stages.back().second;
+    double eventsPerSecond = playSeconds > 0.0 ? allEvents.size() / playSeconds : 0.0;
+    double totalDuration = allEvents.empty() ? 0.0 : allEvents.back()->seconds;
+    uint64_t peakResident = getPeakResidentBytes();
+
+    std::ofstream json(jsonPath);
+    json << std::fixed << std::setprecision(6)
+        << "{\n  \"input\": " << jsonString(inputPath)
+        << ",\n  \"tracks\": " << midiFile.getTrackCount()
+        << ",\n  \"events\": " << allEvents.size()
+        << ",\n  \"duration\": " << totalDuration
+        << ",\n  \"speed\": " << speed
+        << ",\n  \"stages\": {";
+    for (size_t i = 0; i < stages.size(); i++) {
+        json << (i ? ", " : " ") << jsonString(stages[i].first) << ": " << stages[i].second;
+    }
+    json << " },\n  \"loadSeconds\": " << loadSeconds
+        << ",\n  \"eventsPerSecond\": " << eventsPerSecond
+        << ",\n  \"messagesSent\": " << messages
+        << ",\n  \"bytesSent\": " << bytes
+        << ",\n  \"notesCulled\": " << culler.getRetriggersRemoved() + culler.getNpsShed()
+        << ",\n  \"peakResidentBytes\": " << peakResident
+        << ",\n  \"memory\": ";
+    memory.writeJson(json);
+    if (speed > 0.0 && lateness.getCount() > 0) {
+        json << ",\n  \"lateness\": { \"p50\": " << lateness.getPercentile(50.0)
+            << ", \"p99\": " << lateness.getPercentile(99.0)
+            << ", \"p999\": " << lateness.getPercentile(99.9)
+            << ", \"max\": " << lateness.getMax()
+            << ", \"over1ms\": " << lateness.getCountAbove(1000000) << " }";
+    }
+    json << "\n}\n";
+    json.close();
+    if (!json) {
+        SetColor(12);
+        std::cerr << "[!] Failed to write " << jsonPath << "\n";
+        return false;
+    }
+
+    SetColor(15);
+    std::cout << "\n[ Benchmark Information ]" << std::endl;
+    SetColor(11);
+    std::cout << "  Input: " << inputPath << "\n"
+        << "  Events: " << allEvents.size() << "\n"
+        << std::fixed << std::setprecision(3);
+    for (const auto& stage : stages) {
+        std::cout << "  " << stage.first << ": " << stage.second << "s\n";
+    }
+    std::cout << std::setprecision(0)
+        << "  Playback: " << eventsPerSecond << " events/s\n"
+        << "  Peak Memory: " << peakResident / (1024 * 1024) << " MiB";
+    printMemoryReport(memory);
+    std::cout << "\n";
+    if (speed > 0.0 && lateness.getCount() > 0) {
+        std::cout << std::setprecision(2)
+            << "  Lateness p99: " << lateness.getPercentile(99.0) / 1e6 << " ms, max "
+            << lateness.getMax() / 1e6 << " ms\n";
+    }
+    std::cout << "  Results: " << jsonPath << "\n";
+    return true;
+}
+
+// Options shared by the offline modes: [transpose N] [volume F] [retrigger] [nps N [channel]],
+// plus [threads N] [rate N] when rendering
+bool parseOfflineOptions(int argc, char* argv[], int first, RenderSettings* render) {
+    for (int i = first; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "transpose" && i + 1 < argc) {
+            globalTranspose = std::atoi(argv[++i]);
+        }
+        else if (option == "volume" && i + 1 < argc) {
+            globalVolumeFactor = std::atof(argv[++i]);
+        }
+        else if (option == "retrigger") {
+            globalCullRetriggers = true;
+        }
+        else if (option == "nps" && i + 1 < argc) {
+            double maxNps = std::atof(argv[++i]);
+            globalMaxNps = maxNps > 0.0 ? maxNps : 0.0;
+            if (i + 1 < argc && std::string(argv[i + 1]) == "channel") {
+                globalCullPerChannel = true;
+                i++;
+            }
+        }
+        else if (render && option == "threads" && i + 1 < argc) {
+            int threads = std::atoi(argv[++i]);
+            render->threads = threads > 0 ? static_cast<unsigned int>(threads) : 0;
+        }
+        else if (render && option == "rate" && i + 1 < argc) {
+            int rate = std::atoi(argv[++i]);
+            render->sampleRate = rate >= 8000 ? static_cast<unsigned int>(rate) : 44100;
+        }
+        else {
+            SetColor(12);
+            std::cerr << "[!] Unknown option: " << option << "\n";
+            return false;
+        }
+    }
+    return true;
+}
+
+// MIDIPLAYER export <input.mid> <output.mid> [options]
+int runExport(int argc, char* argv[]) {
+    if (argc < 4) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER export <input.mid> <output.mid> [transpose N] [volume F] [retrigger] [nps N [channel]]\n";
+        return 1;
+    }
+    if (!parseOfflineOptions(argc, argv, 4, nullptr)) return 1;
+
+    SetColor(6);
+    std::cout << "[*] Exporting " << argv[2] << "..." << std::endl;
+    bool ok = exportMidiFile(argv[2], argv[3]);
+    SetColor(15);
+    return ok ? 0 : 1;
+}
+
+// MIDIPLAYER bench <input.mid> <results.json> [speed F] [options]
+int runBench(int argc, char* argv[]) {
+    if (argc < 4) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER bench <input.mid> <results.json> [speed F] [transpose N] [volume F] [retrigger] [nps N [channel]]\n";
+        return 1;
+    }
+
+    // speed is ours, the rest are the usual offline options
+    double speed = 0.0;
+    std::vector<char*> options;
+    for (int i = 4; i < argc; i++) {
+        if (std::string(argv[i]) == "speed" && i + 1 < argc) {
+            speed = std::atof(argv[++i]);
+            if (speed < 0.0) speed = 0.0;
+        }
+        else {
+            options.push_back(argv[i]);
+        }
+    }
+    if (!parseOfflineOptions(static_cast<int>(options.size()), options.data(), 0, nullptr)) return 1;
+
+    SetColor(6);
+    std::cout << "[*] Benchmarking " << argv[2] << "..." << std::endl;
+    bool ok = benchmarkMidiFile(argv[2], argv[3], speed);
+    SetColor(15);
+    return ok ? 0 : 1;
+}
+
+// MIDIPLAYER generate <output.mid> [tracks N] [nps N] [seconds N] [tempos N] [sysex N] [seed N]
+int runGenerate(int argc, char* argv[]) {
+    if (argc < 3) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER generate <output.mid> [tracks N] [nps N] [seconds N] [tempos N] [sysex N] [seed N]\n";
+        return 1;
+    }
+
+    CorpusSettings settings;
+    for (int i = 3; i < argc; i++) {
+        std::string option = argv[i];
+        if (i + 1 >= argc) {
+            SetColor(12);
+            std::cerr << "[!] Missing value for " << option << "\n";
+            return 1;
+        }
+        if (option == "tracks") settings.tracks = std::atoi(argv[++i]);
+        else if (option == "nps") settings.nps = std::atof(argv[++i]);
+        else if (option == "seconds") settings.seconds = std::atof(argv[++i]);
+        else if (option == "tempos") settings.tempoChanges = std::atoi(argv[++i]);
+        else if (option == "sysex") settings.sysexPerSecond = std::atof(argv[++i]);
+        else if (option == "seed") settings.seed = static_cast<uint32_t>(std::strtoul(argv[++i], nullptr, 10));
+        else {
+            SetColor(12);
+            std::cerr << "[!] Unknown option: " << option << "\n";
+            return 1;
+        }
+    }
+
+    SetColor(6);
+    std::cout << "[*] Generating " << argv[2] << "..." << std::endl;
+    CorpusGenerator generator(settings);
+    if (!generator.write(argv[2])) {
+        SetColor(12);
+        std::cerr << "[!] Failed to write " << argv[2] << "\n";
+        return 1;
+    }
+    SetColor(11);
+    std::cout << "  Notes: " << generator.getNoteCount() << "\n"
+        << "  SysEx: " << generator.getSysexCount() << "\n";
+    SetColor(15);
+    return 0;
+}
+
+// MIDIPLAYER render <input.mid> <output.wav> [options]
+int runRender(int argc, char* argv[]) {
+    if (argc < 4) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER render <input.mid> <output.wav> [transpose N] [volume F] [retrigger] [nps N [channel]] [threads N] [rate N]\n";
+        return 1;
+    }
+    RenderSettings settings;
+    if (!parseOfflineOptions(argc, argv, 4, &settings)) return 1;
+
+    SetColor(6);
+    std::cout << "[*] Rendering " << argv[2] << "..." << std::endl;
+    bool ok = renderMidiFile(argv[2], argv[3], settings);
+    SetColor(15);
+    return ok ? 0 : 1;
+}
+
+// MIDIPLAYER record <output.mid> [port N]
+int runRecord(int argc, char* argv[]) {
+    if (argc < 3) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER record <output.mid> [port N]\n";
+        return 1;
+    }
+
+    try {
+        // Deep enough to ride out a burst of 100k+ events/s between two wakeups
+        RtMidiIn midiIn(RtMidi::UNSPECIFIED, "MIDIPLAYER Recorder", 1 << 16);
+        midiIn.ignoreTypes(false, true, true);
+        if (midiIn.getPortCount() == 0) {
+            SetColor(12);
+            std::cerr << "[!] No available MIDI input ports.\n";
+            return 1;
+        }
+
+        int portNumber = -1;
+        if (argc >= 5 && std::string(argv[3]) == "port") {
+            portNumber = std::atoi(argv[4]);
+        }
+        else {
+            SetColor(10);
+            std::cout << "[*] Available MIDI Input Ports:\n";
+            for (unsigned int i = 0; i < midiIn.getPortCount(); i++) {
+                std::cout << i << ": " << midiIn.getPortName(i) << "\n";
+            }
+            SetColor(11);
+            std::string portLine;
+            std::cout << "\nSelect MIDI input port: ";
+            std::getline(std::cin, portLine);
+            portNumber = std::atoi(portLine.c_str());
+        }
+        if (portNumber < 0 || static_cast<unsigned int>(portNumber) >= midiIn.getPortCount()) {
+            SetColor(12);
+            std::cerr << "[!] Invalid MIDI input port.\n";
+            return 1;
+        }
+        midiIn.openPort(portNumber);
+
+        MidiRecorder recorder;
+        if (!recorder.start(midiIn, argv[2])) {
+            SetColor(12);
+            std::cerr << "[!] Failed to create " << argv[2] << "\n";
+            return 1;
+        }
+
+        auto recordStart = std::chrono::steady_clock::now();
+        SetColor(6);
+        std::cout << "[*] Recording " << midiIn.getPortName(portNumber) << " to " << argv[2] << std::endl;
+        SetColor(15);
+        std::cout << "Press Enter to stop..." << std::endl;
+        std::string line;
+        std::getline(std::cin, line);
+
+        bool ok = recorder.stop();
+        midiIn.closePort();
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - recordStart).count();
+        if (!ok) {
+            SetColor(12);
+            std::cerr << "[!] Failed to write " << argv[2] << "\n";
+            return 1;
+        }
+
+        SetColor(15);
+        std::cout << "\n[ Record Information ]" << std::endl;
+        SetColor(11);
+        std::cout << "  Output: " << argv[2] << "\n"
+            << "  Events Recorded: " << recorder.getEventCount() << " (" << recorder.getBytesWritten() << " bytes)\n";
+        if (recorder.getDroppedCount() > 0) {
+            SetColor(12);
+            std::cout << "  Dropped Events: " << recorder.getDroppedCount() << "\n";
+            SetColor(11);
+        }
+        std::cout << "  Buffer Pool: " << recorder.getPoolBytes() / 1024 << " KiB\n"
+            << std::fixed << std::setprecision(2)
+            << "  Recorded " << elapsed << "s\n";
+        SetColor(15);
+        return 0;
+    }
+    catch (RtMidiError& error) {
+        SetColor(12);
+        std::cerr << "[!] MIDI input error: " << error.getMessage() << "\n";
+        SetColor(15);
+        return 1;
+    }
+}
+
+// Live input to output through the playback transform. Everything happens
+// in the input callback, so there is no queue hop and no allocation.
+struct ThruPipeline {
+    RtMidiOut* output = nullptr;
+    NoteCuller culler;
+    long long startTime = 0;
+    // WinMM stamps input in whole milliseconds, too coarse for this path, so
+    // latency is measured from the callback's entry instead
+    bool fromCallbackEntry = false;
+
+    std::atomic<uint64_t> messages{ 0 };
+    std::atomic<uint64_t> culled{ 0 };
+    // Input time stamp (or callback entry) to sendMessage() returning,
+    // reset by every readout
+    std::atomic<uint64_t> latencyCount{ 0 };
+    std::atomic<long long> latencyTotal{ 0 };
+    std::atomic<long long> latencyMax{ 0 };
+    std::atomic<long long> latencyPeak{ 0 };
+};
+
+long long steadyNanoseconds() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void thruCallback(long long time, std::vector<unsigned char>* message, void* userData) {
+    ThruPipeline* thru = static_cast<ThruPipeline*>(userData);
+    long long received = thru->fromCallbackEntry ? steadyNanoseconds() : time;
+    if (message->empty()) return;
+
+    const unsigned char* bytes = message->data();
+    size_t size = message->size();
+    unsigned char transformed[3];
+    unsigned char type = bytes[0] & 0xF0;
+    if ((type == 0x80 || type == 0x90) && size >= 3) {
+        if (!transformNoteMessage(bytes, (time - thru->startTime) * 1e-9, thru->culler, transformed)) {
+            thru->culled.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        bytes = transformed;
+        size = sizeof(transformed);
+    }
+
+    thru->output->sendMessage(bytes, size);
+
+    long long latency = steadyNanoseconds() - received;
+    thru->messages.fetch_add(1, std::memory_order_relaxed);
+    thru->latencyCount.fetch_add(1, std::memory_order_relaxed);
+    thru->latencyTotal.fetch_add(latency, std::memory_order_relaxed);
+    // The readout resets the maximum at any time, so a plain store could
+    // bring back a value it already reported
+    long long worst = thru->latencyMax.load(std::memory_order_relaxed);
+    while (latency > worst && !thru->latencyMax.compare_exchange_weak(worst, latency, std::memory_order_relaxed)) {}
+}
+
+// MIDIPLAYER thru <input port> <output port> [options]
+int runThru(int argc, char* argv[]) {
+    if (argc < 4) {
+        SetColor(12);
+        std::cerr << "[!] Usage: MIDIPLAYER thru <input port> <output port> [transpose N] [volume F] [retrigger] [nps N [channel]]\n";
+        return 1;
+    }
+    if (!parseOfflineOptions(argc, argv, 4, nullptr)) return 1;
+
+    try {
+        RtMidiIn midiIn(RtMidi::UNSPECIFIED, "MIDIPLAYER Thru");
+        RtMidiOut midiOut(RtMidi::UNSPECIFIED, "MIDIPLAYER Thru");
+        unsigned int inputPort = static_cast<unsigned int>(std::atoi(argv[2]));
+        unsigned int outputPort = static_cast<unsigned int>(std::atoi(argv[3]));
+        if (inputPort >= midiIn.getPortCount() || outputPort >= midiOut.getPortCount()) {
+            SetColor(12);
+            std::cerr << "[!] Invalid MIDI port.\n";
+            SetColor(10);
+            std::cout << "[*] Available MIDI Input Ports:\n";
+            for (unsigned int i = 0; i < midiIn.getPortCount(); i++) {
+                std::cout << i << ": " << midiIn.getPortName(i) << "\n";
+            }
+            std::cout << "[*] Available MIDI Output Ports:\n";
+            for (unsigned int i = 0; i < midiOut.getPortCount(); i++) {
+                std::cout << i << ": " << midiOut.getPortName(i) << "\n";
+            }
+            SetColor(15);
+            return 1;
+        }
+
+        ThruPipeline thru;
+        thru.output = &midiOut;
+        thru.startTime = steadyNanoseconds();
+        thru.fromCallbackEntry = midiIn.getCurrentApi() == RtMidi::WINDOWS_MM;
+        midiOut.openPort(outputPort);
+        midiIn.ignoreTypes(false, false, true);
+        midiIn.setTimedCallback(thruCallback, &thru);
+        midiIn.openPort(inputPort);
+
+        SetColor(6);
+        std::cout << "[*] " << midiIn.getPortName(inputPort) << " -> " << midiOut.getPortName(outputPort) << std::endl;
+        SetColor(15);
+        if (thru.fromCallbackEntry) {
+            std::cout << "[*] Latency is measured from the input callback; WinMM time stamps are whole milliseconds" << std::endl;
+        }
+        std::cout << "Press Enter to stop..." << std::endl;
+
+        SetColor(11);
+        while (!_kbhit()) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            uint64_t count = thru.latencyCount.exchange(0, std::memory_order_relaxed);
+            long long total = thru.latencyTotal.exchange(0, std::memory_order_relaxed);
+            long long worst = thru.latencyMax.exchange(0, std::memory_order_relaxed);
+            if (worst > thru.latencyPeak.load()) thru.latencyPeak = worst;
+            std::cout << "\r  Messages: " << thru.messages.load()
+                << " | Latency avg " << (count ? total / static_cast<long long>(count) / 1000 : 0)
+                << " us, max " << worst / 1000 << " us   " << std::flush;
+        }
+        std::string line;
+        std::getline(std::cin, line);
+
+        midiIn.closePort();
+        midiOut.closePort();
+
+        // The window since the last readout
+        long long worst = thru.latencyMax.load();
+        if (worst > thru.latencyPeak.load()) thru.latencyPeak = worst;
+
+        SetColor(15);
+        std::cout << "\n\n[ Thru Information ]" << std::endl;
+        SetColor(11);
+        std::cout << "  Messages Passed: " << thru.messages.load() << "\n";
+        if (thru.culled.load() > 0) {
+            std::cout << "  Culled Notes: " << thru.culled.load() << "\n";
+        }
+        std::cout << "  Worst Latency: " << thru.latencyPeak.load() / 1000 << " us"
+            << (thru.fromCallbackEntry ? " (from callback entry)" : "") << "\n";
+        SetColor(15);
+        return 0;
+    }
+    catch (RtMidiError& error) {
+        SetColor(12);
+        std::cerr << "[!] MIDI error: " << error.getMessage() << "\n";
+        SetColor(15);
+        return 1;
+    }
+}
+
+// MIDIPLAYER loopback [api NAME] [out N] [in N] [rate N] [burst N] [count N] [deferred]
+int runLoopback(int argc, char* argv[]) {
+    LoopbackSettings settings;
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "api" && i + 1 < argc) {
+            settings.api = RtMidi::getCompiledApiByName(argv[++i]);
+            if (settings.api == RtMidi::UNSPECIFIED) {
+                SetColor(12);
+                std::cerr << "[!] Unknown MIDI API: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (option == "out" && i + 1 < argc) {
+            settings.outputPort = std::atoi(argv[++i]);
+        }
+        else if (option == "in" && i + 1 < argc) {
+            settings.inputPort = std::atoi(argv[++i]);
+        }
+        else if (option == "rate" && i + 1 < argc) {
+            settings.rate = std::atof(argv[++i]);
+        }
+        else if (option == "burst" && i + 1 < argc) {
+            settings.burst = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (option == "count" && i + 1 < argc) {
+            settings.count = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (option == "deferred") {
+            settings.deferredDispatch = true;
+        }
+        else {
+            SetColor(12);
+            std::cerr << "[!] Unknown option: " << option << "\n";
+            std::cerr << "[!] Usage: MIDIPLAYER loopback [api NAME] [out N] [in N] [rate N] [burst N] [count N] [deferred]\n";
+            return 1;
+        }
+    }
+
+    LoopbackBench bench(settings);
+    try {
+        SetColor(6);
+        std::cout << "[*] Sending " << settings.count << " probes..." << std::endl;
+        if (!bench.run()) {
+            SetColor(12);
+            std::cerr << "[!] No MIDI input port connected to the output was found. Use \"out N in N\" with a loopback cable or driver.\n";
+            SetColor(15);
+            return 1;
+        }
+    }
+    catch (RtMidiError& error) {
+        SetColor(12);
+        std::cerr << "[!] MIDI error: " << error.getMessage() << "\n";
+        SetColor(15);
+        return 1;
+    }
+
+    const LatencyHistogram& latency = bench.latency();
+    uint64_t lost = bench.getSent() > bench.getReceived() ? bench.getSent() - bench.getReceived() : 0;
+    SetColor(15);
+    std::cout << "\n[ Loopback Information ]" << std::endl;
+    SetColor(11);
+    std::cout << "  Output: " << bench.getOutputName() << "\n"
+        << "  Input: " << bench.getInputName() << "\n"
+        << "  Probes: " << bench.getSent() << " sent, " << bench.getReceived() << " received, " << lost << " lost";
+    if (bench.getOutOfSequence() > 0) {
+        std::cout << ", " << bench.getOutOfSequence() << " out of sequence";
+    }
+    std::cout << "\n" << std::fixed << std::setprecision(1)
+        << "  Latency p50: " << latency.getPercentile(50.0) / 1000.0 << " us\n"
+        << "  Latency p99: " << latency.getPercentile(99.0) / 1000.0 << " us\n"
+        << "  Latency p99.9: " << latency.getPercentile(99.9) / 1000.0 << " us\n"
+        << "  Latency max: " << latency.getMax() / 1000.0 << " us\n"
+        << "  Jitter (p99.9 - p50): " << (latency.getPercentile(99.9) - latency.getPercentile(50.0)) / 1000.0 << " us\n";
+    SetColor(15);
+    return lost > 0 ? 2 : 0;
+}
+
+// MIDIPLAYER sendbench [api NAME] [count N] [batch N]
+int runSendBench(int argc, char* argv[]) {
+    SendBenchSettings settings;
+    for (int i = 2; i < argc; i++) {
+        std::string option = argv[i];
+        if (option == "api" && i + 1 < argc) {
+            settings.api = RtMidi::getCompiledApiByName(argv[++i]);
+            if (settings.api == RtMidi::UNSPECIFIED) {
+                SetColor(12);
+                std::cerr << "[!] Unknown MIDI API: " << argv[i] << "\n";
+                return 1;
+            }
+        }
+        else if (option == "count" && i + 1 < argc) {
+            settings.count = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else if (option == "batch" && i + 1 < argc) {
+            settings.batch = static_cast<unsigned int>(std::atoi(argv[++i]));
+        }
+        else {
+            SetColor(12);
+            std::cerr << "[!] Unknown option: " << option << "\n";
+            std::cerr << "[!] Usage: MIDIPLAYER sendbench [api NAME] [count N] [batch N]\n";
+            return 1;
+        }
+    }
+
+    SetColor(6);
+    std::cout << "[*] Measuring sendMessage on every available MIDI API..." << std::endl;
+    SendBench bench(settings);
+    bench.run();
+
+    SetColor(15);
+    std::cout << "\n[ Send Information ]" << std::endl;
+    SetColor(11);
+    std::string lastPort;
+    for (const SendBenchResult& result : bench.getResults()) {
+        if (result.port != lastPort) {
+            std::cout << "  " << RtMidi::getApiDisplayName(result.api) << " (" << result.port << ")\n";
+            lastPort = result.port;
+        }
+        std::cout << std::fixed << std::setprecision(0)
+            << "    " << std::left << std::setw(8) << result.message << std::setw(8) << (result.batched ? "batched" : "single")
+            << std::right << std::setw(10) << result.nsPerMessage << " ns/msg"
+            << std::setw(12) << result.messagesPerSecond << " msg/s"
+            << "  p50 " << result.p50 << " ns, p99 " << result.p99 << " ns\n";
+    }
+    for (const auto& skipped : bench.getSkipped()) {
+        SetColor(12);
+        std::cout << "  " << RtMidi::getApiDisplayName(skipped.first) << " skipped: " << skipped.second << "\n";
+    }
+    SetColor(15);
+    return bench.getResults().empty() ? 1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc >= 2 && std::string(argv[1]) == "loopback") {
+        return runLoopback(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "sendbench") {
+        return runSendBench(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "thru") {
+        return runThru(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "record") {
+        return runRecord(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "export") {
+        return runExport(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "render") {
+        return runRender(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "bench") {
+        return runBench(argc, argv);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "generate") {
+        return runGenerate(argc, argv);
+    }
+
     try {
         if (IsWindows10OrGreater()) {
             SetColor(6);
@@ -409,13 +1407,17 @@ int main() {
         }
 
         SetColor(11);
-        int portNumber;
-        std::cout << "\nSelect a MIDI port: ";
-        std::cin >> portNumber;
-        std::cin.ignore();
+        std::string portLine;
+        std::cout << "\nSelect MIDI port(s), separated by spaces: ";
+        std::getline(std::cin, portLine);
 
+        OutputRouter router;
         try {
-            midiOut.openPort(portNumber);
+            std::istringstream portList(portLine);
+            int portNumber;
+            while (portList >> portNumber) {
+                router.addPort(portNumber);
+            }
         }
         catch (RtMidiError& error) {
             SetColor(12);
@@ -423,11 +1425,26 @@ int main() {
             return 1;
         }
 
+        if (router.getPortCount() == 0) {
+            SetColor(12);
+            std::cerr << "[!] No MIDI port selected.\n";
+            return 1;
+        }
+
+        if (router.getPortCount() > 1) {
+            SetColor(10);
+            std::cout << "[*] Channels are spread over " << router.getPortCount() << " ports:\n";
+            for (size_t i = 0; i < router.getPortCount(); i++) {
+                std::cout << "  [" << i << "] " << router.getPortName(i) << "\n";
+            }
+        }
+
         while (true) {
             isPaused = false;
             isStopped = false;
             isMidiLoaded = false;
             isPlaybackFinished = false;
+            commandInput.reset();
 
             std::string filePath = openMidiFileDialog();
             if (filePath.empty()) {
@@ -436,7 +1453,8 @@ int main() {
                 break;
             }
 
-            std::thread playbackThread(playMidiFile, filePath, std::ref(midiOut));
+            TRACE_THREAD_NAME("commands");
+            std::thread playbackThread(playMidiFile, filePath, std::ref(router));
 
             {
                 std::unique_lock<std::mutex> lock(mtx);
@@ -444,68 +1462,192 @@ int main() {
             }
 
             SetColor(11);
-            std::cout << "\nCommands (pause/resume/stop/transpose [value]/volume [value]): ";
+            std::cout << "\n" << kCommandPrompt;
 
             while (!isPlaybackFinished.load()) {
-                if (_kbhit()) {
-                    std::string command;
-                    std::getline(std::cin, command);
-                    if (command == "pause") {
-                        isPaused = true;
-                        cv.notify_all();
-                        SetColor(10);
-                        std::cout << "[*] Paused\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
+                // Sleeps until a line is typed or playback ends
+                std::string command;
+                if (!commandInput.waitForCommand(command)) break;
+                if (command == "pause") {
+                    TRACE_INSTANT("pause");
+                    isPaused = true;
+                    cv.notify_all();
+                    SetColor(10);
+                    std::cout << "[*] Paused\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command == "resume") {
+                    TRACE_INSTANT("resume");
+                    isPaused = false;
+                    cv.notify_all();
+                    SetColor(10);
+                    std::cout << "[*] Resumed\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command == "stop") {
+                    TRACE_INSTANT("stop");
+                    isStopped = true;
+                    cv.notify_all();
+                    SetColor(10);
+                    std::cout << "[*] Stopping playback...\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                    break;
+                }
+                else if (command.find("transpose") == 0) {
+                    std::istringstream iss(command);
+                    std::string cmd;
+                    int tVal;
+                    iss >> cmd >> tVal;
+                    globalTranspose = tVal;
+                    SetColor(10);
+                    std::cout << "[*] Transpose set to " << tVal << "\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("volume") == 0) {
+                    std::istringstream iss(command);
+                    std::string cmd;
+                    double vol;
+                    iss >> cmd >> vol;
+                    globalVolumeFactor = vol;
+                    SetColor(10);
+                    std::cout << "[*] Volume factor set to " << vol << "\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("bandwidth") == 0) {
+                    // Bytes per second on the wire, 3125 for a DIN cable, 0 to disable
+                    std::istringstream iss(command);
+                    std::string cmd;
+                    double rate = 0.0;
+                    iss >> cmd >> rate;
+                    router.setBytesPerSecond(rate);
+                    // A shaped port is a byte stream, favour long running-status runs
+                    router.setNoteOffAsNoteOn(rate > 0.0);
+                    SetColor(10);
+                    if (rate > 0.0) std::cout << "[*] Output limited to " << rate << " bytes/s\n";
+                    else std::cout << "[*] Output bandwidth limit disabled\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("cull") == 0) {
+                    // cull retrigger on|off, cull nps [value] [global|channel], cull off
+                    std::istringstream iss(command);
+                    std::string cmd, rule, value, scope;
+                    iss >> cmd >> rule >> value >> scope;
+                    SetColor(10);
+                    if (rule == "off") {
+                        globalCullRetriggers = false;
+                        globalMaxNps = 0.0;
+                        std::cout << "[*] Note culling disabled\n";
                     }
-                    else if (command == "resume") {
-                        isPaused = false;
-                        cv.notify_all();
-                        SetColor(10);
-                        std::cout << "[*] Resumed\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
+                    else if (rule == "retrigger") {
+                        globalCullRetriggers = value != "off";
+                        std::cout << "[*] Retrigger culling " << (globalCullRetriggers ? "enabled" : "disabled") << "\n";
                     }
-                    else if (command == "stop") {
-                        isStopped = true;
-                        cv.notify_all();
-                        SetColor(10);
-                        std::cout << "[*] Stopping playback...\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
-                        break;
+                    else if (rule == "nps") {
+                        double maxNps = std::atof(value.c_str());
+                        globalMaxNps = maxNps > 0.0 ? maxNps : 0.0;
+                        globalCullPerChannel = scope == "channel";
+                        if (globalMaxNps > 0.0) {
+                            std::cout << "[*] NPS ceiling set to " << globalMaxNps.load()
+                                << (globalCullPerChannel ? " per channel\n" : "\n");
+                        }
+                        else {
+                            std::cout << "[*] NPS ceiling disabled\n";
+                        }
                     }
-                    else if (command.find("transpose") == 0) {
-                        std::istringstream iss(command);
-                        std::string cmd;
-                        int tVal;
-                        iss >> cmd >> tVal;
-                        globalTranspose = tVal;
-                        SetColor(10);
-                        std::cout << "[*] Transpose set to " << tVal << "\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
+                    else {
+                        SetColor(12);
+                        std::cout << "[!] Invalid cull rule. Use cull retrigger [on|off], cull nps [value] [global|channel] or cull off\n";
+                    }
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("counters") == 0) {
+                    // counters, counters tracks on|off (from the next file), counters save [path]
+                    std::istringstream iss(command);
+                    std::string cmd, action, value;
+                    iss >> cmd >> action;
+                    std::getline(iss >> std::ws, value);
+                    if (action.empty()) {
+                        printTrafficCounters();
                     }
-                    else if (command.find("volume") == 0) {
-                        std::istringstream iss(command);
-                        std::string cmd;
-                        double vol;
-                        iss >> cmd >> vol;
-                        globalVolumeFactor = vol;
+                    else if (action == "tracks") {
+                        globalTrackCounters = value != "off";
                         SetColor(10);
-                        std::cout << "[*] Volume factor set to " << vol << "\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
+                        std::cout << "[*] Track counters " << (globalTrackCounters ? "enabled" : "disabled")
+                            << " from the next file\n";
+                    }
+                    else if (action == "save" && !value.empty()) {
+                        std::ofstream file(value);
+                        trafficCounters.writeJson(file);
+                        if (file.good()) {
+                            SetColor(10);
+                            std::cout << "[*] Counters saved to " << value << "\n";
+                        }
+                        else {
+                            SetColor(12);
+                            std::cout << "[!] Failed to write " << value << "\n";
+                        }
                     }
                     else {
                         SetColor(12);
-                        std::cout << "[!] Invalid command. Use [pause/resume/stop/transpose [value]/volume [value]]\n";
-                        SetColor(11);
-                        std::cout << "Commands (pause/resume/stop/transpose [value]/volume [value]): ";
+                        std::cout << "[!] Invalid counters command. Use counters, counters tracks [on|off] or counters save [path]\n";
+                    }
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("refresh") == 0) {
+                    // How often the console title is redrawn, 50 to 10000 ms
+                    std::istringstream iss(command);
+                    std::string cmd;
+                    int ms = 0;
+                    iss >> cmd >> ms;
+                    if (ms < 50 || ms > 10000) {
+                        SetColor(12);
+                        std::cout << "[!] Invalid refresh interval. Use refresh [50-10000]\n";
+                    }
+                    else {
+                        globalStatsRefreshMs = ms;
+                        SetColor(10);
+                        std::cout << "[*] Title refreshed every " << ms << " ms\n";
+                    }
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
+                }
+                else if (command.find("route") == 0) {
+                    // Channels are 1-16, ports index the list printed at startup, port -1 clears a track route
+                    std::istringstream iss(command);
+                    std::string cmd, target;
+                    int index = -1;
+                    int port = -2;
+                    iss >> cmd >> target >> index >> port;
+                    if (port >= static_cast<int>(router.getPortCount()) || port < -1
+                        || (target == "channel" && (index < 1 || index > 16 || port < 0))
+                        || (target == "track" && (index < 0 || index >= OutputRouter::kMaxTracks))
+                        || (target != "channel" && target != "track")) {
+                        SetColor(12);
+                        std::cout << "[!] Invalid route. Use route channel [1-16] [port] or route track [index] [port]\n";
+                    }
+                    else {
+                        if (target == "channel") router.routeChannel(index - 1, port);
+                        else router.routeTrack(index, port);
+                        SetColor(10);
+                        std::cout << "[*] " << (target == "channel" ? "Channel " : "Track ") << index
+                            << (port < 0 ? " follows its channel route" : " routed to port " + std::to_string(port)) << "\n";
                     }
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
                 }
                 else {
-                    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                    SetColor(12);
+                    std::cout << "[!] Invalid command. Use [pause/resume/stop/transpose [value]/volume [value]/bandwidth [value]/route [channel|track] [index] [port]/cull [retrigger|nps|off] [value]/refresh [ms]/counters [tracks on|off|save path]]\n";
+                    SetColor(11);
+                    std::cout << kCommandPrompt;
                 }
             }
 
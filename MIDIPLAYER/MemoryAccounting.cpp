@@ -0,0 +1,107 @@
+#include "MemoryAccounting.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include "ProcessMemory.h"
+
+namespace {
+    // Keeps the memory after it aligned like malloc's
+    const size_t kHeaderSize = alignof(std::max_align_t) > sizeof(size_t) ? alignof(std::max_align_t) : sizeof(size_t);
+
+    std::atomic<uint64_t> heapBytes{ 0 };
+    std::atomic<uint64_t> heapPeak{ 0 };
+    std::atomic<uint64_t> heapAllocations{ 0 };
+
+    void* countedAlloc(size_t size) {
+        void* block = std::malloc(size + kHeaderSize);
+        if (!block) return nullptr;
+        *static_cast<size_t*>(block) = size;
+
+        heapAllocations.fetch_add(1, std::memory_order_relaxed);
+        uint64_t now = heapBytes.fetch_add(size, std::memory_order_relaxed) + size;
+        uint64_t peak = heapPeak.load(std::memory_order_relaxed);
+        while (now > peak && !heapPeak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+        return static_cast<char*>(block) + kHeaderSize;
+    }
+
+    void countedFree(void* pointer) {
+        if (!pointer) return;
+        void* block = static_cast<char*>(pointer) - kHeaderSize;
+        heapBytes.fetch_sub(*static_cast<size_t*>(block), std::memory_order_relaxed);
+        std::free(block);
+    }
+
+    void* allocOrThrow(size_t size) {
+        for (;;) {
+            void* pointer = countedAlloc(size);
+            if (pointer) return pointer;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+}
+
+void* operator new(size_t size) { return allocOrThrow(size); }
+void* operator new[](size_t size) { return allocOrThrow(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return countedAlloc(size); }
+void operator delete(void* pointer) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer) noexcept { countedFree(pointer); }
+void operator delete(void* pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { countedFree(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { countedFree(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { countedFree(pointer); }
+
+uint64_t getHeapBytes() {
+    return heapBytes.load(std::memory_order_relaxed);
+}
+
+uint64_t getHeapAllocations() {
+    return heapAllocations.load(std::memory_order_relaxed);
+}
+
+uint64_t getHeapPeakBytes() {
+    return heapPeak.load(std::memory_order_relaxed);
+}
+
+void resetHeapPeak() {
+    heapPeak.store(heapBytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+MemoryReport::MemoryReport()
+    : allocationsAtStart_(getHeapAllocations()) {
+    resetHeapPeak();
+}
+
+void MemoryReport::mark(const char* stage) {
+    MemoryStage sample;
+    sample.name = stage;
+    sample.heapBytes = getHeapBytes();
+    sample.heapPeakBytes = getHeapPeakBytes();
+    sample.allocations = getHeapAllocations() - allocationsAtStart_;
+    sample.residentBytes = getResidentBytes();
+    sample.peakResidentBytes = getPeakResidentBytes();
+    stages_.push_back(sample);
+
+    // The sample itself is counted in the next stage
+    allocationsAtStart_ = getHeapAllocations();
+    resetHeapPeak();
+}
+
+void MemoryReport::writeJson(std::ostream& out) const {
+    out << "[";
+    for (size_t i = 0; i < stages_.size(); i++) {
+        const MemoryStage& stage = stages_[i];
+        out << (i ? ",\n    " : "\n    ")
+            << "{ \"stage\": \"" << stage.name << "\""
+            << ", \"heapBytes\": " << stage.heapBytes
+            << ", \"heapPeakBytes\": " << stage.heapPeakBytes
+            << ", \"allocations\": " << stage.allocations
+            << ", \"residentBytes\": " << stage.residentBytes
+            << ", \"peakResidentBytes\": " << stage.peakResidentBytes << " }";
+    }
+    out << "\n  ]";
+}
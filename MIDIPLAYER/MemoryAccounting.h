@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Heap use as counted by the replaced global operator new and delete in
+// MemoryAccounting.cpp. Every allocation carries a small header with its
+// size, so the counts are exact for everything allocated through new,
+// including the standard containers. Over-aligned allocations and malloc
+// are not counted.
+uint64_t getHeapBytes();
+uint64_t getHeapAllocations();
+// Highest heap use since the last resetHeapPeak()
+uint64_t getHeapPeakBytes();
+void resetHeapPeak();
+
+struct MemoryStage {
+    std::string name;
+    uint64_t heapBytes;          // Live when the stage ended
+    uint64_t heapPeakBytes;      // Highest while the stage ran
+    uint64_t allocations;        // Made while the stage ran
+    uint64_t residentBytes;
+    uint64_t peakResidentBytes;
+};
+
+// Heap and resident memory sampled at the end of every stage of loading
+// and playback, to find the stage that makes a file run out of memory.
+class MemoryReport {
+public:
+    // Starts the first stage
+    MemoryReport();
+
+    // Ends the current stage and starts the next
+    void mark(const char* stage);
+
+    const std::vector<MemoryStage>& getStages() const { return stages_; }
+
+    // The stages as a JSON array
+    void writeJson(std::ostream& out) const;
+
+private:
+    std::vector<MemoryStage> stages_;
+    uint64_t allocationsAtStart_;
+};
@@ -0,0 +1,204 @@
+#include "MidiRecorder.h"
+
+#include <chrono>
+#include <cstring>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <poll.h>
+#endif
+
+namespace {
+    // Every record in a chunk: [int64 time][uint32 size][bytes]
+    const size_t kRecordHeader = sizeof(long long) + sizeof(uint32_t);
+
+    // Drain the input queue in batches of this size
+    const size_t kBatchBytes = 1 << 16;
+    const unsigned int kBatchMessages = 4096;
+
+    // A partly filled chunk is handed to the writer after this long, so the
+    // file keeps growing while the input is quiet
+    const std::chrono::milliseconds kHandOffInterval(250);
+
+    // Most bytes an event adds to a track besides its own: delta time,
+    // SysEx length and the end of track
+    const size_t kEventOverhead = 16;
+
+    long long steadyNanoseconds() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void waitForInput(RtMidiWaitHandle handle, int milliseconds) {
+#ifdef _WIN32
+        WaitForSingleObject(handle, milliseconds);
+#else
+        pollfd descriptor = { handle, POLLIN, 0 };
+        poll(&descriptor, 1, milliseconds);
+#endif
+    }
+}
+
+MidiRecorder::MidiRecorder(size_t chunkBytes, size_t chunkCount)
+    : chunkBytes_(chunkBytes), chunks_(chunkCount), freeChunks_(chunkCount), fullChunks_(chunkCount) {
+    for (Chunk& chunk : chunks_) {
+        chunk.data.reset(new unsigned char[chunkBytes_]);
+    }
+}
+
+MidiRecorder::~MidiRecorder() {
+    stop();
+}
+
+bool MidiRecorder::start(RtMidiIn& input, const std::string& path) {
+    if (isRecording()) return false;
+    if (!writer_.open(path, kTicksPerQuarterNote)) return false;
+
+    // 500000 microseconds per quarter note, the 120 BPM the ticks assume
+    const unsigned char tempo[3] = { 0x07, 0xA1, 0x20 };
+    writer_.writeMeta(0, 0x51, tempo, sizeof(tempo));
+
+    Chunk* chunk;
+    while (freeChunks_.tryPop(chunk)) {}
+    for (Chunk& pooled : chunks_) {
+        pooled.used = 0;
+        freeChunks_.tryPush(&pooled);
+    }
+    current_ = nullptr;
+    events_ = 0;
+    dropped_ = 0;
+    bytesWritten_ = 0;
+    stopping_ = false;
+    captureDone_ = false;
+
+    input.setAbsoluteTimestamps();
+    input.getWaitHandle();
+
+    // Whatever arrived before the recording started is not part of it
+    std::vector<unsigned char> stale;
+    do {
+        input.getMessage(&stale);
+    } while (!stale.empty());
+
+    origin_ = steadyNanoseconds();
+    writerThread_ = std::thread(&MidiRecorder::writerLoop, this);
+    capture_ = std::thread(&MidiRecorder::captureLoop, this, std::ref(input));
+    return true;
+}
+
+bool MidiRecorder::stop() {
+    if (!isRecording()) return false;
+
+    stopping_ = true;
+    capture_.join();
+    writerThread_.join();
+    return writer_.close();
+}
+
+void MidiRecorder::captureLoop(RtMidiIn& input) {
+    std::vector<unsigned char> batch(kBatchBytes);
+    std::vector<RtMidiMessageInfo> info(kBatchMessages);
+    RtMidiWaitHandle handle = input.getWaitHandle();
+    auto lastHandOff = std::chrono::steady_clock::now();
+
+    for (;;) {
+        bool finalPass = stopping_.load();
+        if (!finalPass) waitForInput(handle, 50);
+
+        unsigned int count;
+        do {
+            count = input.getMessages(batch.data(), batch.size(), info.data(), kBatchMessages);
+            for (unsigned int i = 0; i < count; i++) {
+                append(info[i].time, batch.data() + info[i].offset, info[i].size);
+            }
+        } while (count == kBatchMessages);
+
+        auto now = std::chrono::steady_clock::now();
+        if (finalPass || now - lastHandOff >= kHandOffInterval) {
+            handOff();
+            lastHandOff = now;
+        }
+        if (finalPass) break;
+    }
+
+    captureDone_.store(true, std::memory_order_release);
+}
+
+void MidiRecorder::append(long long time, const unsigned char* bytes, size_t size) {
+    size_t needed = kRecordHeader + size;
+    if (needed > chunkBytes_) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    if (current_ && current_->used + needed > chunkBytes_) {
+        handOff();
+    }
+    if (!current_) {
+        Chunk* chunk;
+        if (!freeChunks_.tryPop(chunk)) {
+            // The writer is behind and the pool is exhausted
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        current_ = chunk;
+    }
+
+    unsigned char* record = current_->data.get() + current_->used;
+    uint32_t recordSize = static_cast<uint32_t>(size);
+    std::memcpy(record, &time, sizeof(time));
+    std::memcpy(record + sizeof(time), &recordSize, sizeof(recordSize));
+    std::memcpy(record + kRecordHeader, bytes, size);
+    current_->used += needed;
+    events_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void MidiRecorder::handOff() {
+    if (!current_ || current_->used == 0) return;
+    // Every chunk fits, the queue is as large as the pool
+    fullChunks_.tryPush(current_);
+    current_ = nullptr;
+}
+
+void MidiRecorder::writerLoop() {
+    for (;;) {
+        Chunk* chunk;
+        if (fullChunks_.tryPop(chunk)) {
+            writeChunk(*chunk);
+            chunk->used = 0;
+            freeChunks_.tryPush(chunk);
+            continue;
+        }
+        if (captureDone_.load(std::memory_order_acquire)) {
+            if (fullChunks_.empty()) break;
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+}
+
+void MidiRecorder::writeChunk(const Chunk& chunk) {
+    size_t position = 0;
+    while (position < chunk.used) {
+        const unsigned char* record = chunk.data.get() + position;
+        long long time;
+        uint32_t size;
+        std::memcpy(&time, record, sizeof(time));
+        std::memcpy(&size, record + sizeof(time), sizeof(size));
+        const unsigned char* bytes = record + kRecordHeader;
+        position += kRecordHeader + size;
+
+        // System common and realtime messages have no place in a file
+        if (size == 0 || bytes[0] > 0xF0) continue;
+
+        long long elapsed = time - origin_;
+        int tick = elapsed > 0 ? static_cast<int>(elapsed * kTicksPerSecond / 1000000000LL) : 0;
+
+        // Continue in a new track before this one outgrows its length field;
+        // the tracks of a format 1 file play together, so the timing holds
+        if (writer_.getTrackBytes() + size + kEventOverhead > SmfWriter::kMaxTrackBytes) {
+            writer_.nextTrack();
+        }
+        writer_.writeEvent(tick, bytes, size);
+    }
+    bytesWritten_.store(writer_.getBytesWritten(), std::memory_order_relaxed);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RtMidi.h"
+#include "SmfWriter.h"
+#include "SpscQueue.h"
+
+// Records an open input port into a Standard MIDI File. The capture thread
+// sleeps on the input wait handle, drains the queue in batches and appends
+// the events to fixed-size chunks from a pool allocated up front. Full
+// chunks go to a writer thread that encodes them with SmfWriter and hands
+// them back. Memory use depends only on the pool, however long the
+// recording runs; if the writer falls behind until the pool is empty,
+// events are dropped and counted rather than growing the pool. A recording
+// that outgrows the 4 GiB a track can hold continues in another track.
+class MidiRecorder {
+public:
+    // Time base of the recording: 960 ticks per quarter note at 120 BPM
+    static constexpr int kTicksPerQuarterNote = 960;
+    static constexpr int kTicksPerSecond = kTicksPerQuarterNote * 2;
+
+    explicit MidiRecorder(size_t chunkBytes = 1 << 18, size_t chunkCount = 64);
+    ~MidiRecorder();
+
+    MidiRecorder(const MidiRecorder&) = delete;
+    MidiRecorder& operator=(const MidiRecorder&) = delete;
+
+    // Start recording from an open port. Enables absolute time stamps on
+    // the input, so events are placed by their arrival time without
+    // summing deltas. Returns false if the file cannot be created.
+    bool start(RtMidiIn& input, const std::string& path);
+
+    // Write out everything captured so far and close the file. Returns
+    // false if anything failed to reach the disk.
+    bool stop();
+
+    bool isRecording() const { return capture_.joinable(); }
+    uint64_t getEventCount() const { return events_.load(std::memory_order_relaxed); }
+    uint64_t getDroppedCount() const { return dropped_.load(std::memory_order_relaxed); }
+    uint64_t getBytesWritten() const { return bytesWritten_.load(std::memory_order_relaxed); }
+    size_t getPoolBytes() const { return chunkBytes_ * chunks_.size(); }
+
+private:
+    struct Chunk {
+        std::unique_ptr<unsigned char[]> data;
+        size_t used = 0;
+    };
+
+    void captureLoop(RtMidiIn& input);
+    void writerLoop();
+    void append(long long time, const unsigned char* bytes, size_t size);
+    void handOff();
+    void writeChunk(const Chunk& chunk);
+
+    size_t chunkBytes_;
+    std::vector<Chunk> chunks_;
+    SpscQueue<Chunk*> freeChunks_;
+    SpscQueue<Chunk*> fullChunks_;
+    Chunk* current_ = nullptr;
+
+    SmfWriter writer_;
+    long long origin_ = 0;
+
+    std::atomic<bool> stopping_{ false };
+    std::atomic<bool> captureDone_{ false };
+    std::thread capture_;
+    std::thread writerThread_;
+
+    std::atomic<uint64_t> events_{ 0 };
+    std::atomic<uint64_t> dropped_{ 0 };
+    std::atomic<uint64_t> bytesWritten_{ 0 };
+};
@@ -0,0 +1,163 @@
+#include "NoteCuller.h"
+
+#include <algorithm>
+
+using namespace smf;
+
+NoteCuller::NoteCuller(const CullSettings& settings) {
+    setSettings(settings);
+}
+
+void NoteCuller::setSettings(const CullSettings& settings) {
+    settings_ = settings;
+    for (int i = 0; i < 17; i++) {
+        tokens_[i] = settings_.maxNps;
+        lastRefill_[i] = -1.0;
+    }
+}
+
+size_t NoteCuller::cullTimeline(std::vector<const MidiEvent*>& events) {
+    if (!settings_.enabled() || events.empty()) return 0;
+
+    std::vector<char> removed(events.size(), 0);
+    std::vector<unsigned int> sounding(16 * 128, 0);
+    std::vector<unsigned int> skip(16 * 128, 0);
+
+    // Retriggers: a note-on for a key that is still held adds nothing audible
+    if (settings_.removeRetriggers) {
+        for (size_t i = 0; i < events.size(); i++) {
+            const MidiEvent* event = events[i];
+            if (!event->isNoteOn() && !event->isNoteOff()) continue;
+            int key = event->getChannelNibble() * 128 + event->getKeyNumber();
+            if (event->isNoteOn()) {
+                if (sounding[key] > 0) {
+                    removed[i] = 1;
+                    skip[key]++;
+                    retriggersRemoved_.fetch_add(1, std::memory_order_relaxed);
+                }
+                else {
+                    sounding[key]++;
+                }
+            }
+            else if (skip[key] > 0) {
+                skip[key]--;
+            }
+            else if (sounding[key] > 0) {
+                sounding[key]--;
+            }
+        }
+    }
+
+    // NPS ceiling: within every slice keep only the loudest notes that fit the budget
+    if (settings_.maxNps > 0.0) {
+        double sliceLength = std::max(0.1, 1.0 / settings_.maxNps);
+        size_t budget = std::max<size_t>(1, static_cast<size_t>(settings_.maxNps * sliceLength));
+        int groups = settings_.perChannel ? 16 : 1;
+        std::vector<std::vector<size_t>> slices(groups);
+
+        auto shed = [&](std::vector<size_t>& slice) {
+            if (slice.size() > budget) {
+                std::nth_element(slice.begin(), slice.begin() + budget, slice.end(), [&](size_t a, size_t b) {
+                    int va = events[a]->getVelocity();
+                    int vb = events[b]->getVelocity();
+                    return va != vb ? va > vb : a < b;
+                    });
+                for (auto it = slice.begin() + budget; it != slice.end(); ++it) {
+                    removed[*it] = 1;
+                }
+                npsShed_.fetch_add(slice.size() - budget, std::memory_order_relaxed);
+            }
+            slice.clear();
+        };
+
+        long long currentSlice = -1;
+        for (size_t i = 0; i < events.size(); i++) {
+            const MidiEvent* event = events[i];
+            if (!event->isNoteOn() || removed[i]) continue;
+            long long slice = static_cast<long long>(event->seconds / sliceLength);
+            if (slice != currentSlice) {
+                for (auto& group : slices) shed(group);
+                currentSlice = slice;
+            }
+            slices[settings_.perChannel ? event->getChannelNibble() : 0].push_back(i);
+        }
+        for (auto& group : slices) shed(group);
+    }
+
+    // Balance: every removed note-on takes the next note-off of its key with it
+    std::fill(skip.begin(), skip.end(), 0u);
+    for (size_t i = 0; i < events.size(); i++) {
+        const MidiEvent* event = events[i];
+        if (event->isNoteOn()) {
+            if (removed[i]) skip[event->getChannelNibble() * 128 + event->getKeyNumber()]++;
+        }
+        else if (event->isNoteOff()) {
+            int key = event->getChannelNibble() * 128 + event->getKeyNumber();
+            if (skip[key] > 0) {
+                skip[key]--;
+                removed[i] = 1;
+                noteOffsRemoved_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < events.size(); i++) {
+        if (!removed[i]) events[kept++] = events[i];
+    }
+    size_t removedCount = events.size() - kept;
+    events.resize(kept);
+    return removedCount;
+}
+
+bool NoteCuller::takeToken(int channel, int velocity, double seconds) {
+    int bucket = settings_.perChannel ? channel : 16;
+    double capacity = settings_.maxNps;
+    if (lastRefill_[bucket] < 0.0) {
+        lastRefill_[bucket] = seconds;
+        tokens_[bucket] = capacity;
+    }
+    tokens_[bucket] = std::min(capacity, tokens_[bucket] + (seconds - lastRefill_[bucket]) * settings_.maxNps);
+    lastRefill_[bucket] = seconds;
+
+    // Quiet notes need more headroom, so they are the first to go as the budget runs out
+    double reserve = capacity * 0.5 * (1.0 - velocity / 127.0);
+    if (tokens_[bucket] - 1.0 < reserve) return false;
+    tokens_[bucket] -= 1.0;
+    return true;
+}
+
+bool NoteCuller::accept(double seconds, const unsigned char* message, size_t size) {
+    if (size < 3) return true;
+    unsigned char type = message[0] & 0xF0;
+    if (type != 0x80 && type != 0x90) return true;
+
+    int channel = message[0] & 0x0F;
+    int key = message[1] & 0x7F;
+    int velocity = message[2];
+
+    if (type == 0x90 && velocity > 0) {
+        if (onlineRules_) {
+            if (settings_.removeRetriggers && sounding_[channel][key] > 0) {
+                skipNoteOffs_[channel][key]++;
+                retriggersRemoved_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (settings_.maxNps > 0.0 && !takeToken(channel, velocity, seconds)) {
+                skipNoteOffs_[channel][key]++;
+                npsShed_.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        sounding_[channel][key]++;
+        return true;
+    }
+
+    if (skipNoteOffs_[channel][key] > 0) {
+        skipNoteOffs_[channel][key]--;
+        noteOffsRemoved_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    if (sounding_[channel][key] > 0) sounding_[channel][key]--;
+    return true;
+}
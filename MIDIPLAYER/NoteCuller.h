@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "MidiFile.h"
+
+struct CullSettings {
+    // Drop note-ons for a key that is already sounding on the same channel
+    bool removeRetriggers = false;
+    // Note-on ceiling per second, 0 disables it
+    double maxNps = 0.0;
+    // Apply the ceiling to every channel separately instead of the whole file
+    bool perChannel = false;
+
+    bool enabled() const { return removeRetriggers || maxNps > 0.0; }
+    bool operator==(const CullSettings& other) const {
+        return removeRetriggers == other.removeRetriggers && maxNps == other.maxNps && perChannel == other.perChannel;
+    }
+    bool operator!=(const CullSettings& other) const { return !(*this == other); }
+};
+
+// Removes notes no synth can render. Works on the whole sorted timeline at
+// load time, where the NPS ceiling can keep the loudest notes of every slice,
+// or online one message at a time when the timeline is not known in advance.
+// For every note-on removed one later note-off for the same channel and key
+// is removed as well, so notes stay balanced.
+class NoteCuller {
+public:
+    explicit NoteCuller(const CullSettings& settings = CullSettings());
+
+    const CullSettings& settings() const { return settings_; }
+
+    // Change the rules used by accept() from now on
+    void setSettings(const CullSettings& settings);
+
+    // Enable the rules in accept(). While disabled, accept() only follows
+    // which notes are sounding so the rules can take over mid-stream.
+    void setOnlineRules(bool enabled) { onlineRules_ = enabled; }
+
+    // Remove culled events from a timeline sorted by time. Returns the
+    // number of events removed.
+    size_t cullTimeline(std::vector<const smf::MidiEvent*>& events);
+
+    // Online culling: returns false when the message should not be sent
+    bool accept(double seconds, const unsigned char* message, size_t size);
+
+    uint64_t getRetriggersRemoved() const { return retriggersRemoved_.load(std::memory_order_relaxed); }
+    uint64_t getNpsShed() const { return npsShed_.load(std::memory_order_relaxed); }
+    uint64_t getNoteOffsRemoved() const { return noteOffsRemoved_.load(std::memory_order_relaxed); }
+
+private:
+    bool takeToken(int channel, int velocity, double seconds);
+
+    CullSettings settings_;
+    bool onlineRules_ = false;
+
+    unsigned int sounding_[16][128] = {};
+    unsigned int skipNoteOffs_[16][128] = {};
+
+    // Token buckets for the online NPS ceiling, index 16 is the global one
+    double tokens_[17] = {};
+    double lastRefill_[17] = {};
+
+    std::atomic<uint64_t> retriggersRemoved_{ 0 };
+    std::atomic<uint64_t> npsShed_{ 0 };
+    std::atomic<uint64_t> noteOffsRemoved_{ 0 };
+};
@@ -0,0 +1,211 @@
+#include "OfflineRenderer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <fstream>
+#include <thread>
+#if defined(_M_X64) || defined(__SSE2__)
+#include <emmintrin.h>
+#define RENDER_SSE2
+#endif
+
+namespace {
+    const size_t kTableSize = 2048;
+    const int64_t kBlockFrames = 4096;
+    const double kAttackSeconds = 0.005;
+    const double kReleaseSeconds = 0.05;
+    // Percussion has no pitch, a short burst of noise stands in for it
+    const double kDrumSeconds = 0.15;
+
+    // dst += src * gain, four frames at a time where SSE2 is available
+    void mixScaled(float* dst, const float* src, float gain, size_t count) {
+        size_t i = 0;
+#ifdef RENDER_SSE2
+        __m128 g = _mm_set1_ps(gain);
+        for (; i + 4 <= count; i += 4) {
+            __m128 d = _mm_loadu_ps(dst + i);
+            __m128 s = _mm_loadu_ps(src + i);
+            _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, g)));
+        }
+#endif
+        for (; i < count; i++) dst[i] += src[i] * gain;
+    }
+
+    // Soft clip to 16-bit; dense passages saturate instead of wrapping
+    void toPcm16(const float* src, unsigned char* out, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            float x = src[i];
+            float y = x / (1.0f + std::fabs(x));
+            int sample = static_cast<int>(std::lround(y * 32767.0f));
+            out[i * 2] = static_cast<unsigned char>(sample & 0xFF);
+            out[i * 2 + 1] = static_cast<unsigned char>((sample >> 8) & 0xFF);
+        }
+    }
+
+    // Position-independent noise so a voice sounds the same in any block
+    float noise(uint32_t seed, int64_t frame) {
+        uint32_t x = seed * 0x9E3779B1u ^ static_cast<uint32_t>(frame) * 0x85EBCA77u;
+        x ^= x >> 15;
+        x *= 0x2C1B3C6Du;
+        x ^= x >> 12;
+        return static_cast<float>(x & 0xFFFF) / 32768.0f - 1.0f;
+    }
+
+    void putLittleEndian(std::ofstream& file, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) file.put(static_cast<char>((value >> (i * 8)) & 0xFF));
+    }
+
+    void writeWavHeader(std::ofstream& file, unsigned int sampleRate, uint32_t dataBytes) {
+        file.write("RIFF", 4);
+        putLittleEndian(file, 36 + dataBytes, 4);
+        file.write("WAVEfmt ", 8);
+        putLittleEndian(file, 16, 4);
+        putLittleEndian(file, 1, 2); // PCM
+        putLittleEndian(file, 1, 2); // mono
+        putLittleEndian(file, sampleRate, 4);
+        putLittleEndian(file, sampleRate * 2, 4);
+        putLittleEndian(file, 2, 2);
+        putLittleEndian(file, 16, 2);
+        file.write("data", 4);
+        putLittleEndian(file, dataBytes, 4);
+    }
+}
+
+OfflineRenderer::OfflineRenderer(const RenderSettings& settings)
+    : settings_(settings) {
+    threads_ = settings_.threads > 0 ? settings_.threads : std::max(1u, std::thread::hardware_concurrency());
+    attackFrames_ = std::max<int64_t>(1, static_cast<int64_t>(kAttackSeconds * settings_.sampleRate));
+    releaseFrames_ = std::max<int64_t>(1, static_cast<int64_t>(kReleaseSeconds * settings_.sampleRate));
+
+    // A few harmonics so overlapping voices stay distinguishable in a diff
+    const double pi = 3.14159265358979323846;
+    wavetable_.resize(kTableSize + 1);
+    for (size_t i = 0; i < kTableSize; i++) {
+        double phase = 2.0 * pi * i / kTableSize;
+        wavetable_[i] = static_cast<float>((std::sin(phase) + 0.3 * std::sin(2 * phase) + 0.15 * std::sin(3 * phase)) / 1.45);
+    }
+    wavetable_[kTableSize] = wavetable_[0];
+}
+
+bool OfflineRenderer::render(const std::vector<RenderNote>& notes, const std::string& wavPath) {
+    framesWritten_ = 0;
+
+    std::ofstream file(wavPath, std::ios::binary | std::ios::trunc);
+    if (!file) return false;
+    writeWavHeader(file, settings_.sampleRate, 0);
+
+    int64_t totalFrames = 0;
+    for (const RenderNote& note : notes) totalFrames = std::max(totalFrames, voiceEnd(note));
+
+    // Data chunk sizes are 32-bit
+    const int64_t maxFrames = (0xFFFFFFFFll - 36) / 2;
+    totalFrames = std::min(totalFrames, maxFrames);
+
+    const size_t batchBlocks = threads_ * 4;
+    const int64_t batchFrames = kBlockFrames * static_cast<int64_t>(batchBlocks);
+    std::vector<float> mix(static_cast<size_t>(batchFrames));
+    std::vector<unsigned char> pcm(static_cast<size_t>(batchFrames) * 2);
+    std::vector<std::vector<float>> scratch(threads_, std::vector<float>(kBlockFrames));
+
+    // Notes sounding somewhere in the current batch, kept in note order
+    std::vector<uint32_t> active;
+    size_t nextNote = 0;
+
+    for (int64_t batchStart = 0; batchStart < totalFrames; batchStart += batchFrames) {
+        int64_t batchEnd = std::min(totalFrames, batchStart + batchFrames);
+        double batchEndSeconds = static_cast<double>(batchEnd) / settings_.sampleRate;
+
+        active.erase(std::remove_if(active.begin(), active.end(), [&](uint32_t index) {
+            return voiceEnd(notes[index]) <= batchStart;
+            }), active.end());
+        while (nextNote < notes.size() && notes[nextNote].start < batchEndSeconds) {
+            active.push_back(static_cast<uint32_t>(nextNote++));
+        }
+
+        std::fill(mix.begin(), mix.end(), 0.0f);
+        size_t blocks = static_cast<size_t>((batchEnd - batchStart + kBlockFrames - 1) / kBlockFrames);
+        std::atomic<size_t> nextBlock(0);
+
+        auto worker = [&](unsigned int id) {
+            size_t block;
+            while ((block = nextBlock.fetch_add(1)) < blocks) {
+                int64_t blockStart = batchStart + static_cast<int64_t>(block) * kBlockFrames;
+                renderBlock(notes, active, blockStart, mix.data() + block * kBlockFrames, scratch[id]);
+            }
+        };
+
+        std::vector<std::thread> workers;
+        for (unsigned int i = 1; i < std::min<size_t>(threads_, blocks); i++) {
+            workers.emplace_back(worker, i);
+        }
+        worker(0);
+        for (auto& thread : workers) thread.join();
+
+        size_t frames = static_cast<size_t>(batchEnd - batchStart);
+        toPcm16(mix.data(), pcm.data(), frames);
+        file.write(reinterpret_cast<const char*>(pcm.data()), frames * 2);
+        framesWritten_ += frames;
+    }
+
+    file.seekp(0);
+    writeWavHeader(file, settings_.sampleRate, static_cast<uint32_t>(framesWritten_ * 2));
+    return static_cast<bool>(file);
+}
+
+int64_t OfflineRenderer::voiceEnd(const RenderNote& note) const {
+    if (note.channel == 9) {
+        return static_cast<int64_t>(note.start * settings_.sampleRate) + static_cast<int64_t>(kDrumSeconds * settings_.sampleRate);
+    }
+    return static_cast<int64_t>(note.end * settings_.sampleRate) + releaseFrames_;
+}
+
+void OfflineRenderer::renderBlock(const std::vector<RenderNote>& notes, const std::vector<uint32_t>& active,
+    int64_t blockStart, float* out, std::vector<float>& scratch) const {
+    int64_t blockEnd = blockStart + kBlockFrames;
+    for (uint32_t index : active) {
+        const RenderNote& note = notes[index];
+        int64_t from = std::max(static_cast<int64_t>(note.start * settings_.sampleRate), blockStart);
+        int64_t to = std::min(voiceEnd(note), blockEnd);
+        if (from >= to) continue;
+
+        renderVoice(note, index, from, to, scratch.data());
+        float gain = settings_.gain * note.velocity / 127.0f;
+        mixScaled(out + (from - blockStart), scratch.data(), gain, static_cast<size_t>(to - from));
+    }
+}
+
+void OfflineRenderer::renderVoice(const RenderNote& note, uint32_t index, int64_t from, int64_t to, float* scratch) const {
+    int64_t start = static_cast<int64_t>(note.start * settings_.sampleRate);
+    size_t count = static_cast<size_t>(to - from);
+
+    if (note.channel == 9) {
+        float length = static_cast<float>(kDrumSeconds * settings_.sampleRate);
+        for (size_t i = 0; i < count; i++) {
+            int64_t t = from + static_cast<int64_t>(i) - start;
+            scratch[i] = noise(index, t) * (1.0f - t / length);
+        }
+        return;
+    }
+
+    int64_t release = static_cast<int64_t>(note.end * settings_.sampleRate);
+    double frequency = 440.0 * std::pow(2.0, (note.key - 69) / 12.0);
+    double increment = frequency * kTableSize / settings_.sampleRate;
+    // Phase from the absolute offset, so block boundaries leave no trace
+    double phase = std::fmod((from - start) * increment, static_cast<double>(kTableSize));
+
+    for (size_t i = 0; i < count; i++) {
+        int64_t t = from + static_cast<int64_t>(i) - start;
+        size_t position = static_cast<size_t>(phase);
+        float fraction = static_cast<float>(phase - position);
+        float sample = wavetable_[position] + (wavetable_[position + 1] - wavetable_[position]) * fraction;
+
+        float envelope = t < attackFrames_ ? static_cast<float>(t) / attackFrames_ : 1.0f;
+        int64_t released = from + static_cast<int64_t>(i) - release;
+        if (released > 0) envelope *= 1.0f - static_cast<float>(released) / releaseFrames_;
+        scratch[i] = sample * envelope;
+
+        phase += increment;
+        if (phase >= kTableSize) phase -= kTableSize;
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+struct RenderNote {
+    double start;
+    double end;
+    unsigned char channel;
+    unsigned char key;
+    unsigned char velocity;
+};
+
+struct RenderSettings {
+    unsigned int sampleRate = 44100;
+    // 0 uses every hardware thread
+    unsigned int threads = 0;
+    // Level of a single full-velocity voice before the soft clipper
+    float gain = 0.25f;
+};
+
+// Renders notes to a mono 16-bit WAV file with a small wavetable synth, so
+// output can be checked without a MIDI device. The timeline is cut into
+// fixed blocks of frames that worker threads render in parallel; every
+// block always mixes its voices in note order, so the file is bit for bit
+// the same whatever the thread count. Blocks are written in order as soon
+// as a batch is done, so memory does not grow with the length of the file.
+class OfflineRenderer {
+public:
+    explicit OfflineRenderer(const RenderSettings& settings = RenderSettings());
+
+    // Notes must be sorted by start time. Returns false if the file could
+    // not be written.
+    bool render(const std::vector<RenderNote>& notes, const std::string& wavPath);
+
+    unsigned int getThreadCount() const { return threads_; }
+    uint64_t getFramesWritten() const { return framesWritten_; }
+
+private:
+    // First frame after the voice has died away
+    int64_t voiceEnd(const RenderNote& note) const;
+    void renderBlock(const std::vector<RenderNote>& notes, const std::vector<uint32_t>& active,
+        int64_t blockStart, float* out, std::vector<float>& scratch) const;
+    void renderVoice(const RenderNote& note, uint32_t index, int64_t from, int64_t to, float* scratch) const;
+
+    RenderSettings settings_;
+    unsigned int threads_;
+    int64_t attackFrames_;
+    int64_t releaseFrames_;
+    std::vector<float> wavetable_;
+    uint64_t framesWritten_ = 0;
+};
@@ -0,0 +1,150 @@
+#include "OutputRouter.h"
+
+#include <algorithm>
+
+OutputRouter::OutputRouter()
+    : trackPort_(new std::atomic<int>[kMaxTracks]) {
+    for (int i = 0; i < kMaxTracks; i++) trackPort_[i].store(-1, std::memory_order_relaxed);
+    for (int i = 0; i < 16; i++) channelPort_[i].store(-1, std::memory_order_relaxed);
+    clearNotes();
+}
+
+OutputRouter::~OutputRouter() {
+    for (auto& port : ports_) {
+        // The shaper releases held notes before its port closes
+        port->shaper.reset();
+    }
+}
+
+void OutputRouter::addPort(unsigned int portNumber) {
+    checkPortLimit();
+    std::unique_ptr<Port> port(new Port);
+    port->out.reset(new RtMidiOut());
+    port->out->openPort(portNumber);
+    port->name = port->out->getPortName(portNumber);
+    port->sink.reset(new RtMidiSink(*port->out));
+    start(std::move(port));
+}
+
+void OutputRouter::addSink(std::unique_ptr<MidiSink> sink, const std::string& name) {
+    checkPortLimit();
+    std::unique_ptr<Port> port(new Port);
+    port->name = name;
+    port->sink = std::move(sink);
+    start(std::move(port));
+}
+
+void OutputRouter::checkPortLimit() const {
+    if (ports_.size() >= kMaxPorts) {
+        throw RtMidiError("OutputRouter: no more than 255 output ports can be opened.", RtMidiError::INVALID_USE);
+    }
+}
+
+void OutputRouter::start(std::unique_ptr<Port> port) {
+    port->shaper.reset(new OutputShaper(*port->sink));
+    ports_.push_back(std::move(port));
+}
+
+void OutputRouter::routeTrack(int track, int port) {
+    if (track < 0 || track >= kMaxTracks) return;
+    if (port >= static_cast<int>(ports_.size())) return;
+    trackPort_[track].store(port < 0 ? -1 : port, std::memory_order_relaxed);
+}
+
+void OutputRouter::routeChannel(int channel, int port) {
+    if (channel < 0 || channel >= 16) return;
+    if (port >= static_cast<int>(ports_.size())) return;
+    channelPort_[channel].store(port < 0 ? -1 : port, std::memory_order_relaxed);
+}
+
+int OutputRouter::resolve(int track, int channel) const {
+    if (track >= 0 && track < kMaxTracks) {
+        int port = trackPort_[track].load(std::memory_order_relaxed);
+        if (port >= 0) return port;
+    }
+    int port = channelPort_[channel].load(std::memory_order_relaxed);
+    if (port >= 0) return port;
+    return channel % static_cast<int>(ports_.size());
+}
+
+void OutputRouter::submit(int track, const unsigned char* message, size_t size) {
+    if (size == 0 || ports_.empty()) return;
+
+    // System messages have no channel and always go to the first port
+    int channel = message[0] < 0xF0 ? (message[0] & 0x0F) : 0;
+    int port = resolve(track, channel);
+    unsigned char type = message[0] & 0xF0;
+
+    if ((type == 0x80 || type == 0x90) && size >= 3) {
+        uint8_t& sounding = notePort_[channel][message[1] & 0x7F];
+        if (type == 0x90 && message[2] > 0) {
+            // The key still sounds on the port it was routed to before: end
+            // it there, the new note-on takes its place here
+            if (sounding != kNoPort && sounding != port) {
+                unsigned char noteOff[3] = { static_cast<unsigned char>(0x80 | channel), message[1], 0 };
+                ports_[sounding]->shaper->submit(noteOff, sizeof(noteOff));
+            }
+            sounding = static_cast<uint8_t>(port);
+        }
+        else if (sounding != kNoPort) {
+            port = sounding;
+            sounding = kNoPort;
+        }
+    }
+    else if (type == 0xB0 && size >= 3 && (message[1] == 120 || message[1] == 123)) {
+        // All sound/notes off also reaches the ports this channel's notes
+        // still sound on
+        for (int key = 0; key < 128; key++) {
+            uint8_t& sounding = notePort_[channel][key];
+            if (sounding == kNoPort) continue;
+            if (sounding != port) {
+                uint8_t other = sounding;
+                ports_[other]->shaper->submit(message, size);
+                for (int k = key; k < 128; k++) {
+                    if (notePort_[channel][k] == other) notePort_[channel][k] = kNoPort;
+                }
+            }
+            sounding = kNoPort;
+        }
+    }
+
+    ports_[port]->shaper->submit(message, size);
+}
+
+void OutputRouter::clearNotes() {
+    std::fill(&notePort_[0][0], &notePort_[0][0] + 16 * 128, kNoPort);
+}
+
+void OutputRouter::drain() {
+    for (auto& port : ports_) port->shaper->drain();
+    clearNotes();
+}
+
+void OutputRouter::panic() {
+    for (auto& port : ports_) port->shaper->panic();
+    clearNotes();
+}
+
+void OutputRouter::setBytesPerSecond(double bytesPerSecond) {
+    for (auto& port : ports_) port->shaper->setBytesPerSecond(bytesPerSecond);
+}
+
+void OutputRouter::setNoteOffAsNoteOn(bool enabled) {
+    for (auto& port : ports_) port->shaper->setNoteOffAsNoteOn(enabled);
+}
+
+unsigned long long OutputRouter::getCarriedOverCount() const {
+    unsigned long long total = 0;
+    for (auto& port : ports_) {
+        if (port->out) total += port->out->getCarriedOverCount();
+    }
+    return total;
+}
+
+unsigned long long OutputRouter::getDroppedCount() const {
+    unsigned long long total = 0;
+    for (auto& port : ports_) {
+        if (port->out) total += port->out->getDroppedCount();
+    }
+    return total;
+}
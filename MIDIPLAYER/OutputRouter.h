@@ -0,0 +1,87 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "RtMidi.h"
+#include "OutputShaper.h"
+
+// Spreads the output of the scheduler over several MIDI ports. Every port
+// has one sender thread, its shaper's, fed through a single-producer queue,
+// so a slow device only backs up its own queue and not the other ports. The
+// scheduler only waits for a port whose queue is full.
+//
+// Routing: a track routed to a port wins, otherwise the channel decides.
+// By default channels are spread round-robin over the opened ports. A
+// note-off goes to the port its note-on went to, so changing a route while
+// a note sounds does not leave it hanging on the old port.
+class OutputRouter {
+public:
+    static constexpr int kMaxTracks = 65536;
+    // Port numbers are kept in a byte per sounding note, 0xFF meaning none
+    static constexpr size_t kMaxPorts = 255;
+
+    OutputRouter();
+    ~OutputRouter();
+
+    OutputRouter(const OutputRouter&) = delete;
+    OutputRouter& operator=(const OutputRouter&) = delete;
+
+    // Open another output port. Throws RtMidiError if it cannot be opened
+    // or kMaxPorts are already open.
+    void addPort(unsigned int portNumber);
+
+    // Add a port that delivers to the sink instead of a MIDI device.
+    // Throws RtMidiError if kMaxPorts are already open.
+    void addSink(std::unique_ptr<MidiSink> sink, const std::string& name);
+
+    size_t getPortCount() const { return ports_.size(); }
+    const std::string& getPortName(size_t index) const { return ports_[index]->name; }
+    OutputShaper& shaper(size_t index) { return *ports_[index]->shaper; }
+
+    // Port -1 removes the track route so the channel route applies again
+    void routeTrack(int track, int port);
+    void routeChannel(int channel, int port);
+
+    // Queue a message for the port this track/channel is routed to.
+    // Only the scheduler thread may call this.
+    void submit(int track, const unsigned char* message, size_t size);
+
+    // Wait until every queued message was sent, at the shaped rate. Used
+    // when the file plays to its end.
+    void drain();
+
+    // Send the pending note-offs at once and drop the pending note-ons.
+    // Used on stop.
+    void panic();
+
+    void setBytesPerSecond(double bytesPerSecond);
+    void setNoteOffAsNoteOn(bool enabled);
+
+    unsigned long long getCarriedOverCount() const;
+    unsigned long long getDroppedCount() const;
+
+private:
+    struct Port {
+        std::string name;
+        std::unique_ptr<RtMidiOut> out;     // Null for a sink added with addSink()
+        std::unique_ptr<MidiSink> sink;
+        std::unique_ptr<OutputShaper> shaper;
+    };
+
+    static constexpr uint8_t kNoPort = 0xFF;
+
+    void checkPortLimit() const;
+    void start(std::unique_ptr<Port> port);
+    int resolve(int track, int channel) const;
+    void clearNotes();
+
+    std::vector<std::unique_ptr<Port>> ports_;
+    std::unique_ptr<std::atomic<int>[]> trackPort_;
+    std::atomic<int> channelPort_[16];
+    // Port each sounding channel/key was sent to. Only the scheduler thread
+    // touches it, through submit(), drain() and panic().
+    uint8_t notePort_[16][128];
+};
@@ -0,0 +1,328 @@
+#include "OutputShaper.h"
+
+#include <algorithm>
+#include <climits>
+#include "Tracer.h"
+
+OutputShaper::OutputShaper(MidiSink& sink, double bytesPerSecond, double maxLatencySeconds)
+    : sink_(sink), bytesPerSecond_(bytesPerSecond), maxLatencySeconds_(maxLatencySeconds), input_(kQueueCapacity) {
+    sender_ = std::thread(&OutputShaper::senderLoop, this);
+}
+
+OutputShaper::~OutputShaper() {
+    {
+        std::lock_guard<std::mutex> lock(queueMtx_);
+        stopping_ = true;
+    }
+    queueCv_.notify_all();
+    if (sender_.joinable()) {
+        sender_.join();
+    }
+}
+
+void OutputShaper::setBytesPerSecond(double bytesPerSecond) {
+    bytesPerSecond_.store(bytesPerSecond < 0.0 ? 0.0 : bytesPerSecond);
+    queueCv_.notify_all();
+}
+
+void OutputShaper::setNoteOffAsNoteOn(bool enabled) {
+    std::lock_guard<std::mutex> lock(sendMtx_);
+    encoder_.setNoteOffAsNoteOn(enabled);
+}
+
+size_t OutputShaper::getBacklogBytes() {
+    std::lock_guard<std::mutex> lock(queueMtx_);
+    return backlogBytes_;
+}
+
+void OutputShaper::submit(const unsigned char* message, size_t size) {
+    if (size == 0) return;
+
+    Input input{};
+    if (size > sizeof(input.bytes)) {
+        std::lock_guard<std::mutex> lock(inputSysexMtx_);
+        inputSysex_.emplace_back(message, message + size);
+    }
+    else {
+        std::copy(message, message + size, input.bytes);
+        input.size = static_cast<unsigned char>(size);
+    }
+
+    while (!input_.tryPush(input)) {
+        std::this_thread::yield();
+    }
+
+    // Pairs with the fence in senderLoop so a sleeping sender always sees the message
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (sleeping_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(queueMtx_);
+        queueCv_.notify_one();
+    }
+}
+
+void OutputShaper::takeInput(std::unique_lock<std::mutex>& lock) {
+    Input input;
+    std::vector<unsigned char> sysex;
+    while (input_.tryPop(input)) {
+        const unsigned char* bytes = input.bytes;
+        size_t size = input.size;
+        if (size == 0) {
+            std::lock_guard<std::mutex> sysexLock(inputSysexMtx_);
+            sysex = std::move(inputSysex_.front());
+            inputSysex_.pop_front();
+            bytes = sysex.data();
+            size = sysex.size();
+        }
+
+        // Shaping disabled and nothing left over from before: send right away
+        if (bytesPerSecond_.load() <= 0.0 && isIdle()) {
+            inFlight_ = true;
+            lock.unlock();
+            try {
+                sendNow(bytes, size);
+            }
+            catch (RtMidiError&) {
+                // Already reported by RtMidi; the other messages still go out
+            }
+            lock.lock();
+            inFlight_ = false;
+        }
+        else {
+            accept(bytes, size);
+        }
+    }
+    idleCv_.notify_all();
+}
+
+void OutputShaper::accept(const unsigned char* message, size_t size) {
+    double rate = bytesPerSecond_.load();
+    unsigned char type = message[0] & 0xF0;
+    int channel = message[0] & 0x0F;
+    bool isNoteOn = type == 0x90 && size >= 3 && message[2] > 0;
+    bool isNoteOff = (type == 0x80 || type == 0x90) && size >= 3 && !isNoteOn;
+
+    Pending pending{};
+    pending.queued = Clock::now();
+    pending.seq = seq_++;
+
+    if (size > sizeof(pending.bytes)) {
+        // SysEx keeps its place in the urgent queue through a zero-size marker
+        sysex_.emplace_back(message, message + size);
+        urgent_.push_back(pending);
+        backlogBytes_ += size;
+        return;
+    }
+
+    std::copy(message, message + size, pending.bytes);
+    pending.size = static_cast<unsigned char>(size);
+
+    if (isNoteOff) {
+        int key = message[1] & 0x7F;
+        if (shedNotes_[channel][key] > 0) {
+            // Its note-on never made it to the wire
+            shedNotes_[channel][key]--;
+            return;
+        }
+        // A note-on for this key still waiting in the backlog would now be
+        // stale, so drop it but keep the note-off in case an earlier note on
+        // the same key is sounding.
+        for (auto it = noteOns_.begin(); it != noteOns_.end(); ++it) {
+            if ((it->bytes[0] & 0x0F) == channel && it->bytes[1] == key) {
+                backlogBytes_ -= it->size;
+                noteOns_.erase(it);
+                shed_.fetch_add(1, std::memory_order_relaxed);
+                break;
+            }
+        }
+        urgent_.push_back(pending);
+    }
+    else if (isNoteOn) {
+        noteOns_.insert(pending);
+    }
+    else {
+        urgent_.push_back(pending);
+    }
+    backlogBytes_ += size;
+
+    // Keep the note-on backlog within what the link can send inside the latency bound
+    if (rate > 0.0 && maxLatencySeconds_ > 0.0) {
+        size_t cap = static_cast<size_t>(rate * maxLatencySeconds_);
+        while (backlogBytes_ > cap && !noteOns_.empty()) {
+            shedNoteOn(std::prev(noteOns_.end()));
+        }
+    }
+}
+
+void OutputShaper::drain() {
+    std::unique_lock<std::mutex> lock(queueMtx_);
+    idleCv_.wait(lock, [this] { return stopping_ || (input_.empty() && isIdle()); });
+
+    // Note-offs of shed note-ons that never arrived no longer matter
+    std::fill(&shedNotes_[0][0], &shedNotes_[0][0] + 16 * 128, static_cast<unsigned short>(0));
+}
+
+void OutputShaper::panic() {
+    // Let the sender take in everything queued before the call, so its
+    // note-offs are sent here too, and finish the message it is sending.
+    // Otherwise a note-on it already took could reach the port after the
+    // note-off sent here, and the note would hang
+    std::unique_lock<std::mutex> lock(queueMtx_);
+    queueCv_.notify_all();
+    idleCv_.wait(lock, [this] { return stopping_ || (input_.empty() && !inFlight_); });
+
+    while (!urgent_.empty()) {
+        Pending pending = urgent_.front();
+        urgent_.pop_front();
+        if (pending.size == 0) {
+            std::vector<unsigned char> sysex = std::move(sysex_.front());
+            sysex_.pop_front();
+            sendNow(sysex.data(), sysex.size());
+        }
+        else {
+            sendNow(pending.bytes, pending.size);
+        }
+    }
+    noteOns_.clear();
+    backlogBytes_ = 0;
+    std::fill(&shedNotes_[0][0], &shedNotes_[0][0] + 16 * 128, static_cast<unsigned short>(0));
+
+    std::lock_guard<std::mutex> sendLock(sendMtx_);
+    encoder_.reset();
+}
+
+void OutputShaper::shedNoteOn(std::multiset<Pending, ByVelocity>::iterator it) {
+    int channel = it->bytes[0] & 0x0F;
+    int key = it->bytes[1] & 0x7F;
+    if (shedNotes_[channel][key] < USHRT_MAX) shedNotes_[channel][key]++;
+    backlogBytes_ -= it->size;
+    noteOns_.erase(it);
+    shed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool OutputShaper::takeNext(Pending& out, std::vector<unsigned char>& sysex, Clock::time_point now) {
+    if (!urgent_.empty()) {
+        out = urgent_.front();
+        urgent_.pop_front();
+        if (out.size == 0) {
+            sysex = std::move(sysex_.front());
+            sysex_.pop_front();
+            backlogBytes_ -= sysex.size();
+        }
+        else {
+            backlogBytes_ -= out.size;
+        }
+        return true;
+    }
+
+    // Note-ons that waited past the latency bound are no longer worth sending
+    if (bytesPerSecond_.load() > 0.0 && maxLatencySeconds_ > 0.0) {
+        auto deadline = now - std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(maxLatencySeconds_));
+        for (auto it = noteOns_.begin(); it != noteOns_.end();) {
+            auto next = std::next(it);
+            if (it->queued < deadline) shedNoteOn(it);
+            it = next;
+        }
+    }
+
+    if (noteOns_.empty()) return false;
+
+    out = *noteOns_.begin();
+    noteOns_.erase(noteOns_.begin());
+    backlogBytes_ -= out.size;
+    return true;
+}
+
+size_t OutputShaper::sendNow(const unsigned char* message, size_t size) {
+    TRACE_SCOPE("send");
+    std::lock_guard<std::mutex> lock(sendMtx_);
+    // Charged at full size unless the sink really leaves out the status byte
+    size_t cost = size;
+    if (size <= 3) {
+        unsigned char wire[3];
+        size_t encoded = encoder_.encode(message, size, wire);
+        if (sink_.appliesRunningStatus()) {
+            cost = encoded;
+            runningStatusSaved_.store(encoder_.getBytesSaved(), std::memory_order_relaxed);
+        }
+    }
+    else {
+        encoder_.reset();
+    }
+
+    if (encoder_.getNoteOffAsNoteOn() && size == 3 && (message[0] & 0xF0) == 0x80) {
+        unsigned char noteOn[3] = { static_cast<unsigned char>(0x90 | (message[0] & 0x0F)), message[1], 0 };
+        sink_.send(noteOn, 3);
+    }
+    else {
+        sink_.send(message, size);
+    }
+    sent_.fetch_add(1, std::memory_order_relaxed);
+    sentBytes_.fetch_add(cost, std::memory_order_relaxed);
+    return cost;
+}
+
+void OutputShaper::senderLoop() {
+    TRACE_THREAD_NAME("shaper sender");
+    Clock::time_point nextFree = Clock::now();
+    std::vector<unsigned char> sysex;
+
+    std::unique_lock<std::mutex> lock(queueMtx_);
+    while (true) {
+        takeInput(lock);
+        if (stopping_) break;
+
+        if (urgent_.empty() && noteOns_.empty()) {
+            idleCv_.notify_all();
+            sleeping_.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            TRACE_BEGIN("sleep");
+            queueCv_.wait(lock, [this] { return stopping_ || !input_.empty(); });
+            TRACE_END("sleep");
+            sleeping_.store(false, std::memory_order_relaxed);
+            continue;
+        }
+
+        double rate = bytesPerSecond_.load();
+        auto now = Clock::now();
+        if (rate > 0.0 && now < nextFree) {
+            queueCv_.wait_until(lock, nextFree);
+            continue;
+        }
+
+        Pending pending;
+        if (!takeNext(pending, sysex, now)) {
+            // Everything left was shed
+            idleCv_.notify_all();
+            continue;
+        }
+        inFlight_ = true;
+        lock.unlock();
+
+        size_t cost = 0;
+        try {
+            if (pending.size == 0) cost = sendNow(sysex.data(), sysex.size());
+            else cost = sendNow(pending.bytes, pending.size);
+        }
+        catch (RtMidiError&) {
+            // Already reported by RtMidi; keep serving the remaining messages
+        }
+
+        if (rate > 0.0) {
+            nextFree = std::max(nextFree, now) + std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(static_cast<double>(cost) / rate));
+        }
+        lock.lock();
+        inFlight_ = false;
+        idleCv_.notify_all();
+    }
+
+    // Release every held note before the port goes away
+    idleCv_.notify_all();
+    lock.unlock();
+    try {
+        panic();
+    }
+    catch (RtMidiError&) {
+    }
+}
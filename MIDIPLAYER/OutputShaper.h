@@ -0,0 +1,165 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "RtMidi.h"
+#include "RunningStatusEncoder.h"
+#include "SpscQueue.h"
+
+// Where a shaper delivers its messages
+class MidiSink {
+public:
+    virtual ~MidiSink() = default;
+    virtual void send(const unsigned char* message, size_t size) = 0;
+
+    // True when the sink puts a byte stream on the wire and leaves out
+    // repeated status bytes itself, so a message costs less than its size
+    virtual bool appliesRunningStatus() const { return false; }
+};
+
+// Delivers to an open RtMidi output port. RtMidi hands the driver whole
+// messages, so the full size is charged.
+class RtMidiSink : public MidiSink {
+public:
+    explicit RtMidiSink(RtMidiOut& port) : port_(port) {}
+    void send(const unsigned char* message, size_t size) override { port_.sendMessage(message, size); }
+
+private:
+    RtMidiOut& port_;
+};
+
+// Paces the messages sent to one output port so they never exceed the byte
+// rate of the physical link. A 5-pin DIN cable carries 31250 baud with 10 bits
+// per byte, i.e. 3125 bytes/s; anything faster only builds a backlog in the
+// driver and the synth falls further and further behind the file.
+//
+// When the budget is exceeded, messages are reordered: note-offs and other
+// channel messages go first in arrival order, then note-ons by descending
+// velocity. Note-ons that have waited longer than the latency bound, or that
+// overflow the backlog, are shed lowest velocity first together with their
+// matching note-off.
+//
+// Wire cost is the full message size, or the size with running status
+// applied for sinks that apply it. Rewriting note-offs as note-ons with
+// velocity 0 can be enabled so interfaces that use running status on their
+// DIN output get longer runs.
+//
+// A byte rate of 0 disables shaping and messages are sent straight through.
+//
+// Messages reach the shaper's sender thread through a single-producer queue,
+// so the producer takes no lock. That thread is the only one per port: it
+// moves what was queued into the backlog and sends from there.
+class OutputShaper {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static constexpr double kDinBytesPerSecond = 3125.0;
+    // Enough for several seconds of a dense file before the producer has to wait
+    static constexpr size_t kQueueCapacity = 1 << 16;
+
+    explicit OutputShaper(MidiSink& sink, double bytesPerSecond = 0.0, double maxLatencySeconds = 0.1);
+    ~OutputShaper();
+
+    OutputShaper(const OutputShaper&) = delete;
+    OutputShaper& operator=(const OutputShaper&) = delete;
+
+    // Queue a message for sending. Only one thread may call this. When the
+    // queue is full, because the port stalled for longer than the queue
+    // holds, the caller yields until there is room rather than lose a
+    // note-off.
+    void submit(const unsigned char* message, size_t size);
+
+    // Block until everything queued has been sent at the shaped rate, or
+    // shed once it waited past the latency bound, e.g. at the end of the file.
+    void drain();
+
+    // Send every pending note-off at once, discard pending note-ons and reset
+    // the running status, e.g. when playback stops. A message the sender
+    // thread is already sending goes out first.
+    void panic();
+
+    void setBytesPerSecond(double bytesPerSecond);
+    double getBytesPerSecond() const { return bytesPerSecond_.load(); }
+
+    void setNoteOffAsNoteOn(bool enabled);
+
+    MidiSink& sink() { return sink_; }
+
+    uint64_t getSentCount() const { return sent_.load(std::memory_order_relaxed); }
+    uint64_t getSentBytes() const { return sentBytes_.load(std::memory_order_relaxed); }
+    uint64_t getShedCount() const { return shed_.load(std::memory_order_relaxed); }
+    uint64_t getRunningStatusSavings() const { return runningStatusSaved_.load(std::memory_order_relaxed); }
+    size_t getBacklogBytes();
+
+private:
+    struct Pending {
+        Clock::time_point queued;
+        uint64_t seq;
+        unsigned char bytes[3];
+        unsigned char size;
+    };
+
+    // Highest velocity first, oldest first among equal velocities
+    struct ByVelocity {
+        bool operator()(const Pending& a, const Pending& b) const {
+            if (a.bytes[2] != b.bytes[2]) return a.bytes[2] > b.bytes[2];
+            return a.seq < b.seq;
+        }
+    };
+
+    // Messages longer than bytes are kept in inputSysex_ and marked by size 0
+    struct Input {
+        unsigned char bytes[3];
+        unsigned char size;
+    };
+
+    void senderLoop();
+    void takeInput(std::unique_lock<std::mutex>& lock);
+    void accept(const unsigned char* message, size_t size);
+    bool isIdle() const { return urgent_.empty() && noteOns_.empty() && !inFlight_; }
+    bool takeNext(Pending& out, std::vector<unsigned char>& sysex, Clock::time_point now);
+    void shedNoteOn(std::multiset<Pending, ByVelocity>::iterator it);
+    size_t sendNow(const unsigned char* message, size_t size);
+
+    MidiSink& sink_;
+    std::atomic<double> bytesPerSecond_;
+    double maxLatencySeconds_;
+
+    SpscQueue<Input> input_;
+    std::mutex inputSysexMtx_;
+    std::deque<std::vector<unsigned char>> inputSysex_;
+    std::atomic<bool> sleeping_{ false };
+
+    std::mutex queueMtx_;
+    std::condition_variable queueCv_;
+    // Signalled whenever the sender finishes a message or empties input_
+    std::condition_variable idleCv_;
+    std::deque<Pending> urgent_;
+    std::deque<std::vector<unsigned char>> sysex_;
+    std::multiset<Pending, ByVelocity> noteOns_;
+    size_t backlogBytes_ = 0;
+    uint64_t seq_ = 0;
+    bool stopping_ = false;
+    // Taken off the queue by the sender but not yet handed to the port
+    bool inFlight_ = false;
+
+    // Note-ons shed per channel/key whose note-off must be swallowed
+    unsigned short shedNotes_[16][128] = {};
+
+    std::mutex sendMtx_;
+    RunningStatusEncoder encoder_;
+
+    std::atomic<uint64_t> sent_{ 0 };
+    std::atomic<uint64_t> sentBytes_{ 0 };
+    std::atomic<uint64_t> shed_{ 0 };
+    std::atomic<uint64_t> runningStatusSaved_{ 0 };
+
+    std::thread sender_;
+};
@@ -0,0 +1,115 @@
+#include "PlaybackStats.h"
+
+void StatsWriter::reset(double windowSeconds) {
+    windowSeconds_ = windowSeconds > 0.0 ? windowSeconds : 1.0;
+    local_ = StatsSnapshot();
+    if (window_.empty()) window_.resize(4096);
+    windowHead_ = 0;
+    windowSize_ = 0;
+    publish();
+}
+
+void StatsWriter::eventDispatched(double timelineSeconds) {
+    local_.playbackTime = timelineSeconds;
+    local_.events++;
+    expire(timelineSeconds);
+    publish();
+}
+
+void StatsWriter::noteOn(double timelineSeconds) {
+    if (windowSize_ == window_.size()) {
+        // More notes in one window than ever before: unroll into a larger ring
+        std::vector<double> larger(window_.size() * 2);
+        for (size_t i = 0; i < windowSize_; i++) {
+            larger[i] = window_[(windowHead_ + i) & (window_.size() - 1)];
+        }
+        window_.swap(larger);
+        windowHead_ = 0;
+    }
+    window_[(windowHead_ + windowSize_) & (window_.size() - 1)] = timelineSeconds;
+    windowSize_++;
+
+    local_.notesOn++;
+    local_.windowNotes = windowSize_;
+    publish();
+}
+
+void StatsWriter::expire(double timelineSeconds) {
+    double oldest = timelineSeconds - windowSeconds_;
+    while (windowSize_ > 0 && window_[windowHead_] <= oldest) {
+        windowHead_ = (windowHead_ + 1) & (window_.size() - 1);
+        windowSize_--;
+    }
+    local_.windowNotes = windowSize_;
+}
+
+void StatsWriter::publish() {
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    playbackTime_.store(local_.playbackTime, std::memory_order_relaxed);
+    events_.store(local_.events, std::memory_order_relaxed);
+    notesOn_.store(local_.notesOn, std::memory_order_relaxed);
+    windowNotes_.store(local_.windowNotes, std::memory_order_relaxed);
+
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+StatsSnapshot StatsWriter::read() const {
+    StatsSnapshot snapshot;
+    for (;;) {
+        uint32_t before = sequence_.load(std::memory_order_acquire);
+        if (before & 1) continue;
+
+        snapshot.playbackTime = playbackTime_.load(std::memory_order_relaxed);
+        snapshot.events = events_.load(std::memory_order_relaxed);
+        snapshot.notesOn = notesOn_.load(std::memory_order_relaxed);
+        snapshot.windowNotes = windowNotes_.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence_.load(std::memory_order_relaxed) == before) break;
+    }
+    return snapshot;
+}
+
+PlaybackStats::PlaybackStats(double windowSeconds)
+    : windowSeconds_(windowSeconds > 0.0 ? windowSeconds : 1.0) {
+}
+
+StatsWriter* PlaybackStats::addWriter() {
+    size_t index = writerCount_.load(std::memory_order_relaxed);
+    do {
+        if (index >= kMaxWriters) return nullptr;
+    } while (!writerCount_.compare_exchange_weak(index, index + 1));
+
+    writers_[index].reset(windowSeconds_);
+    return &writers_[index];
+}
+
+StatsSnapshot PlaybackStats::snapshot() const {
+    StatsSnapshot total;
+    size_t count = writerCount_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < count; i++) {
+        StatsSnapshot part = writers_[i].read();
+        if (part.playbackTime > total.playbackTime) total.playbackTime = part.playbackTime;
+        total.events += part.events;
+        total.notesOn += part.notesOn;
+        total.windowNotes += part.windowNotes;
+    }
+    total.nps = total.windowNotes / windowSeconds_;
+    return total;
+}
+
+bool PlaybackStats::waitForRefresh(std::chrono::milliseconds interval) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return !wake_.wait_for(lock, interval, [this] { return stopped_; });
+}
+
+void PlaybackStats::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopped_ = true;
+    }
+    wake_.notify_all();
+}
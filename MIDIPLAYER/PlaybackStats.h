@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// One consistent set of playback counters
+struct StatsSnapshot {
+    double playbackTime = 0.0;  // Timeline position in seconds
+    uint64_t events = 0;
+    uint64_t notesOn = 0;
+    uint64_t windowNotes = 0;   // Note-ons in the last window of timeline time
+    double nps = 0.0;           // Filled in by PlaybackStats::snapshot
+};
+
+// Counters owned by one thread. The owner updates them without locked
+// instructions and publishes them under a sequence lock, so a reader on
+// another thread retries instead of seeing half of an update. NPS counts
+// the note-ons whose timeline time lies within the window behind the
+// current position, so it does not depend on when the counters are read.
+class alignas(64) StatsWriter {
+public:
+    StatsWriter() = default;
+
+    StatsWriter(const StatsWriter&) = delete;
+    StatsWriter& operator=(const StatsWriter&) = delete;
+
+    // Owning thread only
+    void reset(double windowSeconds);
+    void eventDispatched(double timelineSeconds);
+    void noteOn(double timelineSeconds);
+
+    // Any thread
+    StatsSnapshot read() const;
+
+private:
+    void expire(double timelineSeconds);
+    void publish();
+
+    double windowSeconds_ = 1.0;
+
+    // Writer-private state
+    StatsSnapshot local_;
+    std::vector<double> window_;
+    size_t windowHead_ = 0;
+    size_t windowSize_ = 0;
+
+    // Published copy
+    std::atomic<uint32_t> sequence_{ 0 };
+    std::atomic<double> playbackTime_{ 0.0 };
+    std::atomic<uint64_t> events_{ 0 };
+    std::atomic<uint64_t> notesOn_{ 0 };
+    std::atomic<uint64_t> windowNotes_{ 0 };
+};
+
+// Collects the writers of one playback and wakes the thread that reports
+// them. Aggregating reads every writer's snapshot; nothing the writers do
+// waits for a reader.
+class PlaybackStats {
+public:
+    static constexpr size_t kMaxWriters = 8;
+
+    explicit PlaybackStats(double windowSeconds = 1.0);
+
+    PlaybackStats(const PlaybackStats&) = delete;
+    PlaybackStats& operator=(const PlaybackStats&) = delete;
+
+    // Hands out a cleared writer for the calling thread, or nullptr when
+    // all of them are taken
+    StatsWriter* addWriter();
+
+    // Sum of all writers; the position is the furthest one
+    StatsSnapshot snapshot() const;
+
+    // Blocks for the interval or until stop(). Returns false once stopped.
+    bool waitForRefresh(std::chrono::milliseconds interval);
+    void stop();
+
+private:
+    double windowSeconds_;
+    StatsWriter writers_[kMaxWriters];
+    std::atomic<size_t> writerCount_{ 0 };
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopped_ = false;
+};
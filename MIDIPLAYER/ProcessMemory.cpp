@@ -0,0 +1,54 @@
+#include "ProcessMemory.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <cstdio>
+#include <cstring>
+#endif
+
+namespace {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS memoryCounters() {
+        PROCESS_MEMORY_COUNTERS counters = {};
+        counters.cb = sizeof(counters);
+        GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+        return counters;
+    }
+#else
+    // A "Name:   1234 kB" line of /proc/self/status
+    uint64_t readStatusField(const char* name) {
+        FILE* status = std::fopen("/proc/self/status", "r");
+        if (!status) return 0;
+
+        char line[256];
+        size_t length = std::strlen(name);
+        unsigned long long kilobytes = 0;
+        while (std::fgets(line, sizeof(line), status)) {
+            if (std::strncmp(line, name, length) == 0 && line[length] == ':') {
+                std::sscanf(line + length + 1, "%llu", &kilobytes);
+                break;
+            }
+        }
+        std::fclose(status);
+        return kilobytes * 1024;
+    }
+#endif
+}
+
+uint64_t getResidentBytes() {
+#ifdef _WIN32
+    return memoryCounters().WorkingSetSize;
+#else
+    return readStatusField("VmRSS");
+#endif
+}
+
+uint64_t getPeakResidentBytes() {
+#ifdef _WIN32
+    return memoryCounters().PeakWorkingSetSize;
+#else
+    return readStatusField("VmHWM");
+#endif
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Resident memory of this process as the OS reports it, in bytes. 0 where
+// the platform does not tell.
+uint64_t getResidentBytes();
+uint64_t getPeakResidentBytes();
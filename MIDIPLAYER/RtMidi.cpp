@@ -39,6 +39,17 @@
 
 #include "RtMidi.h"
 #include <sstream>
+#include <cstring>
+#include <chrono>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/eventfd.h>
+#endif
+#endif
 #if defined(__APPLE__)
 #include <TargetConditionals.h>
 #endif
@@ -86,7 +97,7 @@
 //
 // **************************************************************** //
 
-#if !defined(__LINUX_ALSA__) && !defined(__UNIX_JACK__) && !defined(__MACOSX_CORE__) && !defined(__WINDOWS_MM__) && !defined(__WINDOWS_UWP__) && !defined(TARGET_IPHONE_OS) && !defined(__WEB_MIDI_API__)  && !defined(__AMIDI__)
+#if !defined(__LINUX_ALSA__) && !defined(__UNIX_JACK__) && !defined(__MACOSX_CORE__) && !defined(__WINDOWS_MM__) && !defined(__WINDOWS_UWP__) && !defined(TARGET_IPHONE_OS) && !defined(__WEB_MIDI_API__)  && !defined(__AMIDI__) && !defined(__UNIX_SHM__)
   #define __RTMIDI_DUMMY__
 #endif
 
@@ -154,6 +165,8 @@ class MidiInJack: public MidiInApi
   std::string clientName;
 
   void connect( void );
+  void startDispatcher( void );
+  void stopDispatcher( void );
   void initialize( const std::string& clientName );
 };
 
@@ -196,9 +209,11 @@ class MidiInAlsa: public MidiInApi
   void setPortName( const std::string &portName);
   unsigned int getPortCount( void );
   std::string getPortName( unsigned int portNumber );
+  void ignoreTypes( bool midiSysex, bool midiTime, bool midiSense );
 
  protected:
   void initialize( const std::string& clientName );
+  void applyEventFilter( void );
 };
 
 class MidiOutAlsa: public MidiOutApi
@@ -278,7 +293,7 @@ public:
     void setPortName(const std::string& portName) override;
     unsigned int getPortCount(void) override;
     std::string getPortName(unsigned int portNumber) override;
-    double getMessage(std::vector<unsigned char>* message) override;
+    double getMessage(std::vector<unsigned char>* message, long long* time) override;
 
 protected:
     void initialize(const std::string& clientName) override;
@@ -417,6 +432,48 @@ class MidiOutAndroid: public MidiOutApi
 
 #endif
 
+#if defined(__UNIX_SHM__)
+
+class MidiInShm: public MidiInApi
+{
+ public:
+  MidiInShm( const std::string &clientName, unsigned int queueSizeLimit );
+  ~MidiInShm( void );
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::UNIX_SHM; };
+  void openPort( unsigned int portNumber, const std::string &portName );
+  void openVirtualPort( const std::string &portName );
+  void closePort( void );
+  void setClientName( const std::string &clientName );
+  void setPortName( const std::string &portName );
+  unsigned int getPortCount( void );
+  std::string getPortName( unsigned int portNumber );
+
+ protected:
+  void initialize( const std::string& clientName );
+  void startReader( void );
+};
+
+class MidiOutShm: public MidiOutApi
+{
+ public:
+  MidiOutShm( const std::string &clientName );
+  ~MidiOutShm( void );
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::UNIX_SHM; };
+  void openPort( unsigned int portNumber, const std::string &portName );
+  void openVirtualPort( const std::string &portName );
+  void closePort( void );
+  void setClientName( const std::string &clientName );
+  void setPortName( const std::string &portName );
+  unsigned int getPortCount( void );
+  std::string getPortName( unsigned int portNumber );
+  void sendMessage( const unsigned char *message, size_t size );
+
+ protected:
+  void initialize( const std::string& clientName );
+};
+
+#endif
+
 #if defined(__RTMIDI_DUMMY__)
 
 class MidiInDummy: public MidiInApi
@@ -494,6 +551,7 @@ const char* rtmidi_api_names[][2] = {
   { "web"         , "Web MIDI API" },
   { "winuwp"      , "Windows UWP" },
   { "amidi"       , "Android MIDI API" },
+  { "shm"         , "Shared Memory" },
 };
 const unsigned int rtmidi_num_api_names =
   sizeof(rtmidi_api_names)/sizeof(rtmidi_api_names[0]);
@@ -519,11 +577,14 @@ extern "C" const RtMidi::Api rtmidi_compiled_apis[] = {
 #if defined(__WEB_MIDI_API__)
   RtMidi::WEB_MIDI_API,
 #endif
-#if defined(__WEB_MIDI_API__)
-  RtMidi::WEB_MIDI_API,
-#endif
 #if defined(__AMIDI__)
   RtMidi::ANDROID_AMIDI,
+#endif
+#if defined(__UNIX_SHM__)
+  RtMidi::UNIX_SHM,
+#endif
+#if defined(__RTMIDI_DUMMY__)
+  RtMidi::RTMIDI_DUMMY,
 #endif
   RtMidi::UNSPECIFIED,
 };
@@ -616,6 +677,10 @@ void RtMidiIn :: openMidiApi( RtMidi::Api api, const std::string &clientName, un
     if ( api == ANDROID_AMIDI )
     rtapi_ = new MidiInAndroid( clientName, queueSizeLimit );
 #endif
+#if defined(__UNIX_SHM__)
+  if ( api == UNIX_SHM )
+    rtapi_ = new MidiInShm( clientName, queueSizeLimit );
+#endif
 #if defined(__RTMIDI_DUMMY__)
   if ( api == RTMIDI_DUMMY )
     rtapi_ = new MidiInDummy( clientName, queueSizeLimit );
@@ -696,6 +761,10 @@ void RtMidiOut :: openMidiApi( RtMidi::Api api, const std::string &clientName )
     if ( api == ANDROID_AMIDI )
     rtapi_ = new MidiOutAndroid( clientName );
 #endif
+#if defined(__UNIX_SHM__)
+  if ( api == UNIX_SHM )
+    rtapi_ = new MidiOutShm( clientName );
+#endif
 #if defined(__RTMIDI_DUMMY__)
   if ( api == RTMIDI_DUMMY )
     rtapi_ = new MidiOutDummy( clientName );
@@ -789,19 +858,33 @@ void MidiApi :: error( RtMidiError::Type type, std::string errorString )
 //  Common MidiInApi Definitions
 //*********************************************************************//
 
+// Current time in nanoseconds on the clock used for absolute input time
+// stamps, see RtMidiIn::setAbsoluteTimestamps().
+static inline long long rtmidiSteadyTime( void )
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Invoke whichever kind of user callback is set.
+static inline void rtmidiInvokeCallback( MidiInApi::RtMidiInData *data, double timeStamp, long long time,
+                                         std::vector<unsigned char> *bytes )
+{
+  if ( data->userTimedCallback )
+    data->userTimedCallback( time, bytes, data->userData );
+  else
+    data->userCallback( timeStamp, bytes, data->userData );
+}
+
 MidiInApi :: MidiInApi( unsigned int queueSizeLimit )
   : MidiApi()
 {
   // Allocate the MIDI queue.
-  inputData_.queue.ringSize = queueSizeLimit;
-  if ( inputData_.queue.ringSize > 0 )
-    inputData_.queue.ring = new MidiMessage[ inputData_.queue.ringSize ];
+  inputData_.queue.allocate( queueSizeLimit );
 }
 
 MidiInApi :: ~MidiInApi( void )
 {
-  // Delete the MIDI queue.
-  if ( inputData_.queue.ringSize > 0 ) delete [] inputData_.queue.ring;
 }
 
 void MidiInApi :: setCallback( RtMidiIn::RtMidiCallback callback, void *userData )
@@ -823,6 +906,26 @@ void MidiInApi :: setCallback( RtMidiIn::RtMidiCallback callback, void *userData
   inputData_.usingCallback = true;
 }
 
+void MidiInApi :: setTimedCallback( RtMidiIn::RtMidiTimedCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInApi::setTimedCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "RtMidiIn::setTimedCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  inputData_.absoluteTime = true;
+  inputData_.userTimedCallback = callback;
+  inputData_.userData = userData;
+  inputData_.usingCallback = true;
+}
+
 void MidiInApi :: cancelCallback()
 {
   if ( !inputData_.usingCallback ) {
@@ -831,22 +934,26 @@ void MidiInApi :: cancelCallback()
     return;
   }
 
+  inputData_.usingCallback = false;
   inputData_.userCallback = 0;
+  inputData_.userTimedCallback = 0;
   inputData_.userData = 0;
-  inputData_.usingCallback = false;
 }
 
 void MidiInApi :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
 {
-  inputData_.ignoreFlags = 0;
-  if ( midiSysex ) inputData_.ignoreFlags = 0x01;
-  if ( midiTime ) inputData_.ignoreFlags |= 0x02;
-  if ( midiSense ) inputData_.ignoreFlags |= 0x04;
+  // Store once: the input thread may be reading the flags right now
+  unsigned char flags = 0;
+  if ( midiSysex ) flags = 0x01;
+  if ( midiTime ) flags |= 0x02;
+  if ( midiSense ) flags |= 0x04;
+  inputData_.ignoreFlags = flags;
 }
 
-double MidiInApi :: getMessage( std::vector<unsigned char> *message )
+double MidiInApi :: getMessage( std::vector<unsigned char> *message, long long *time )
 {
   message->clear();
+  if ( time ) *time = 0;
 
   if ( inputData_.usingCallback ) {
     errorString_ = "RtMidiIn::getNextMessage: a user callback is currently set for this port.";
@@ -855,75 +962,337 @@ double MidiInApi :: getMessage( std::vector<unsigned char> *message )
   }
 
   double timeStamp;
-  if ( !inputData_.queue.pop( message, &timeStamp ) )
+  if ( !inputData_.queue.pop( message, &timeStamp, time ) )
     return 0.0;
 
   return timeStamp;
 }
 
+unsigned int MidiInApi :: getMessages( unsigned char *buffer, size_t bufferSize,
+                                       RtMidiMessageInfo *info, unsigned int maxMessages )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "RtMidiIn::getMessages: a user callback is currently set for this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return 0;
+  }
+
+  // Reset before draining, so a message pushed meanwhile signals again
+  MidiQueue &queue = inputData_.queue;
+  queue.clearSignal();
+
+  unsigned int count = 0;
+  size_t used = 0;
+  bool retried = false;
+  while ( count < maxMessages ) {
+    size_t size;
+    double timeStamp;
+    long long time;
+    int result = queue.popInto( buffer + used, bufferSize - used, &size, &timeStamp, &time );
+    if ( result == 0 ) {
+      // Pairs with the fence in push(): either we see the new message
+      // or the input thread sees the queue empty and signals.
+      if ( retried || !queue.notify.load( std::memory_order_relaxed ) ) break;
+      std::atomic_thread_fence( std::memory_order_seq_cst );
+      retried = true;
+      continue;
+    }
+    if ( result < 0 ) {
+      if ( size <= bufferSize ) break;
+      std::vector<unsigned char> discarded;
+      queue.pop( &discarded, &timeStamp );
+      errorString_ = "RtMidiIn::getMessages: a message larger than the buffer was discarded.";
+      error( RtMidiError::WARNING, errorString_ );
+      continue;
+    }
+
+    info[count].timeStamp = timeStamp;
+    info[count].time = time;
+    info[count].offset = used;
+    info[count].size = size;
+    used += size;
+    count++;
+    retried = false;
+  }
+
+  // Stopped early, leave the handle signaled for what is still queued
+  if ( queue.notify.load( std::memory_order_relaxed ) && queue.size() > 0 )
+    queue.signal();
+  return count;
+}
+
+RtMidiWaitHandle MidiInApi :: getWaitHandle( void )
+{
+  if ( !inputData_.queue.notify.load() && !inputData_.queue.openWaitHandle() ) {
+    errorString_ = "RtMidiIn::getWaitHandle: error creating the wait handle.";
+    error( RtMidiError::SYSTEM_ERROR, errorString_ );
+  }
+  return inputData_.queue.waitHandle;
+}
+
 void MidiInApi :: setBufferSize( unsigned int size, unsigned int count )
 {
     inputData_.bufferSize = size;
     inputData_.bufferCount = count;
 }
 
+void MidiInApi :: setDeferredDispatch( bool enable )
+{
+    inputData_.deferDispatch = enable;
+}
+
+void MidiInApi :: setAbsoluteTimestamps( bool enable )
+{
+    inputData_.absoluteTime = enable;
+}
+
+// Arena bytes reserved per queued message; SysEx dumps larger than half
+// the arena are copied to the heap instead.
+#define RTMIDI_ARENA_BYTES_PER_MESSAGE 256
+#define RTMIDI_ARENA_MIN_SIZE 65536
+// Largest queue size limit; the ring size is the next power of two
+#define RTMIDI_QUEUE_MAX_SIZE 0x80000000u
+
+// Capped at RTMIDI_QUEUE_MAX_SIZE, beyond which size would overflow to 0
+static unsigned int nextPowerOfTwo( unsigned int value )
+{
+  unsigned int size = 2;
+  while ( size < value && size < RTMIDI_QUEUE_MAX_SIZE ) size <<= 1;
+  return size;
+}
+
+MidiInApi::MidiQueue::~MidiQueue()
+{
+  if ( ring ) {
+    for ( unsigned int i = front.load(); i != back.load(); i++ )
+      delete [] ring[i & ringMask].large;
+    delete [] ring;
+  }
+  delete [] arena;
+
+  if ( notify.load() ) {
+#if defined(_WIN32)
+    CloseHandle( (HANDLE) waitHandle );
+#else
+    if ( signalFd != waitHandle ) close( signalFd );
+    close( waitHandle );
+#endif
+  }
+}
+
+// Called by the reading thread before it first waits
+bool MidiInApi::MidiQueue::openWaitHandle( void )
+{
+#if defined(_WIN32)
+  HANDLE event = CreateEvent( NULL, FALSE, FALSE, NULL );
+  if ( event == NULL ) return false;
+  waitHandle = (RtMidiWaitHandle) event;
+#elif defined(__linux__)
+  int fd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( fd < 0 ) return false;
+  waitHandle = fd;
+  signalFd = fd;
+#else
+  int fds[2];
+  if ( pipe( fds ) < 0 ) return false;
+  for ( int i = 0; i < 2; i++ ) {
+    fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+    fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+  }
+  waitHandle = fds[0];
+  signalFd = fds[1];
+#endif
+
+  // Messages queued before the handle existed must not be missed
+  notify.store( true );
+  if ( size() > 0 ) signal();
+  return true;
+}
+
+// Called only from the input thread.  Pushes until endBatch() skip the
+// wakeup check; endBatch() then wakes the reader once if anything is
+// left for it.
+void MidiInApi::MidiQueue::beginBatch( void )
+{
+  batching = true;
+}
+
+void MidiInApi::MidiQueue::endBatch( void )
+{
+  if ( !batching ) return;
+  batching = false;
+  if ( notify.load( std::memory_order_acquire ) ) {
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( front.load( std::memory_order_relaxed ) != back.load( std::memory_order_relaxed ) ) signal();
+  }
+}
+
+void MidiInApi::MidiQueue::signal( void )
+{
+#if defined(_WIN32)
+  SetEvent( (HANDLE) waitHandle );
+#elif defined(__linux__)
+  uint64_t one = 1;
+  ssize_t written = write( signalFd, &one, sizeof( one ) );
+  (void) written;
+#else
+  char byte = 1;
+  ssize_t written = write( signalFd, &byte, 1 );
+  (void) written;
+#endif
+}
+
+void MidiInApi::MidiQueue::clearSignal( void )
+{
+  if ( !notify.load( std::memory_order_relaxed ) ) return;
+#if defined(_WIN32)
+  ResetEvent( (HANDLE) waitHandle );
+#elif defined(__linux__)
+  uint64_t count;
+  ssize_t result = read( waitHandle, &count, sizeof( count ) );
+  (void) result;
+#else
+  char bytes[64];
+  while ( read( waitHandle, bytes, sizeof( bytes ) ) > 0 ) {}
+#endif
+}
+
+void MidiInApi::MidiQueue::allocate( unsigned int queueSizeLimit )
+{
+  limit = queueSizeLimit < RTMIDI_QUEUE_MAX_SIZE ? queueSizeLimit : RTMIDI_QUEUE_MAX_SIZE;
+  if ( limit == 0 ) return;
+
+  ringSize = nextPowerOfTwo( limit );
+  ringMask = ringSize - 1;
+  ring = new Slot[ ringSize ];
+
+  unsigned int arenaBytes = limit < 0x100000 ? limit * RTMIDI_ARENA_BYTES_PER_MESSAGE : 0x10000000;
+  arenaSize = nextPowerOfTwo( arenaBytes < RTMIDI_ARENA_MIN_SIZE ? RTMIDI_ARENA_MIN_SIZE : arenaBytes );
+  arena = new unsigned char[ arenaSize ];
+}
+
 unsigned int MidiInApi::MidiQueue::size( unsigned int *__back,
                                          unsigned int *__front )
 {
-  // Access back/front members exactly once and make stack copies for
-  // size calculation
-  unsigned int _back = back, _front = front, _size;
-  if ( _back >= _front )
-    _size = _back - _front;
-  else
-    _size = ringSize - _front + _back;
+  // Load back/front exactly once; indices run freely and wrap together
+  unsigned int _back = back.load( std::memory_order_acquire );
+  unsigned int _front = front.load( std::memory_order_acquire );
 
-  // Return copies of back/front so no new and unsynchronized accesses
-  // to member variables are needed.
   if ( __back ) *__back = _back;
   if ( __front ) *__front = _front;
-  return _size;
+  return _back - _front;
 }
 
-// As long as we haven't reached our queue size limit, push the message.
 bool MidiInApi::MidiQueue::push( const MidiInApi::MidiMessage& msg )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
+  return push( msg.bytes.empty() ? 0 : &msg.bytes[0], msg.bytes.size(), msg.timeStamp, msg.time );
+}
 
-  // Get back/front indexes exactly once and calculate current size
-  _size = size( &_back, &_front );
+// As long as we haven't reached our queue size limit, push the message.
+// Called only from the input thread.
+bool MidiInApi::MidiQueue::push( const unsigned char *bytes, size_t size, double timeStamp, long long time )
+{
+  unsigned int _back = back.load( std::memory_order_relaxed );
+  if ( ring == 0 || _back - front.load( std::memory_order_acquire ) >= limit )
+    return false;
 
-  if ( _size < ringSize-1 )
-  {
-    ring[_back] = msg;
-    back = (back+1)%ringSize;
-    return true;
+  Slot &slot = ring[_back & ringMask];
+  slot.timeStamp = timeStamp;
+  slot.time = time;
+  slot.size = (unsigned int) size;
+  slot.large = 0;
+
+  unsigned int _arenaBack = arenaBack.load( std::memory_order_relaxed );
+  if ( size <= INLINE_BYTES ) {
+    if ( size ) memcpy( slot.bytes, bytes, size );
+  }
+  else if ( size <= arenaSize / 2 ) {
+    // Keep every message contiguous: skip the tail of the arena if needed
+    unsigned int offset = _arenaBack & ( arenaSize - 1 );
+    unsigned int skip = offset + size > arenaSize ? arenaSize - offset : 0;
+    if ( _arenaBack + skip + size - arenaFront.load( std::memory_order_acquire ) > arenaSize )
+      return false;
+    _arenaBack += skip;
+    memcpy( arena + ( _arenaBack & ( arenaSize - 1 ) ), bytes, size );
+    _arenaBack += (unsigned int) size;
+  }
+  else {
+    slot.large = new unsigned char[size];
+    memcpy( slot.large, bytes, size );
   }
+  slot.arenaEnd = _arenaBack;
+  arenaBack.store( _arenaBack, std::memory_order_relaxed );
+
+  back.store( _back + 1, std::memory_order_release );
 
-  return false;
+  // Signal only when the reader may have seen the queue empty
+  if ( !batching && notify.load( std::memory_order_acquire ) ) {
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( front.load( std::memory_order_relaxed ) == _back ) signal();
+  }
+  return true;
 }
 
-bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeStamp )
+// Called only from the reading thread.
+bool MidiInApi::MidiQueue::pop( std::vector<unsigned char> *msg, double* timeStamp, long long *time )
 {
-  // Local stack copies of front/back
-  unsigned int _back, _front, _size;
-
-  // Get back/front indexes exactly once and calculate current size
-  _size = size( &_back, &_front );
-
-  if ( _size == 0 )
+  unsigned int _front = front.load( std::memory_order_relaxed );
+  if ( ring == 0 || _front == back.load( std::memory_order_acquire ) )
     return false;
 
   // Copy queued message to the vector pointer argument and then "pop" it.
-  msg->assign( ring[_front].bytes.begin(), ring[_front].bytes.end() );
-  *timeStamp = ring[_front].timeStamp;
+  Slot &slot = ring[_front & ringMask];
+  if ( slot.large ) {
+    msg->assign( slot.large, slot.large + slot.size );
+    delete [] slot.large;
+    slot.large = 0;
+  }
+  else if ( slot.size <= INLINE_BYTES ) {
+    msg->assign( slot.bytes, slot.bytes + slot.size );
+  }
+  else {
+    const unsigned char *start = arena + ( ( slot.arenaEnd - slot.size ) & ( arenaSize - 1 ) );
+    msg->assign( start, start + slot.size );
+  }
+  *timeStamp = slot.timeStamp;
+  if ( time ) *time = slot.time;
 
-  // Update front
-  front = (front+1)%ringSize;
+  // Hand the slot and its arena bytes back to the input thread
+  arenaFront.store( slot.arenaEnd, std::memory_order_release );
+  front.store( _front + 1, std::memory_order_release );
   return true;
 }
 
+// Called only from the reading thread.
+int MidiInApi::MidiQueue::popInto( unsigned char *buffer, size_t capacity, size_t *size, double *timeStamp, long long *time )
+{
+  unsigned int _front = front.load( std::memory_order_relaxed );
+  if ( ring == 0 || _front == back.load( std::memory_order_acquire ) )
+    return 0;
+
+  Slot &slot = ring[_front & ringMask];
+  *size = slot.size;
+  if ( slot.size > capacity )
+    return -1;
+
+  const unsigned char *start;
+  if ( slot.large )
+    start = slot.large;
+  else if ( slot.size <= INLINE_BYTES )
+    start = slot.bytes;
+  else
+    start = arena + ( ( slot.arenaEnd - slot.size ) & ( arenaSize - 1 ) );
+  if ( slot.size ) memcpy( buffer, start, slot.size );
+  *timeStamp = slot.timeStamp;
+  *time = slot.time;
+
+  delete [] slot.large;
+  slot.large = 0;
+  arenaFront.store( slot.arenaEnd, std::memory_order_release );
+  front.store( _front + 1, std::memory_order_release );
+  return 1;
+}
+
 //*********************************************************************//
 //  Common MidiOutApi Definitions
 //*********************************************************************//
@@ -937,6 +1306,21 @@ MidiOutApi :: ~MidiOutApi( void )
 {
 }
 
+void MidiOutApi :: setEventBudget( unsigned int eventsPerCycle )
+{
+  outputData_.eventBudget.store( eventsPerCycle, std::memory_order_relaxed );
+}
+
+unsigned long long MidiOutApi :: getCarriedOverCount( void ) const
+{
+  return outputData_.carriedOver.load( std::memory_order_relaxed );
+}
+
+unsigned long long MidiOutApi :: getDroppedCount( void ) const
+{
+  return outputData_.dropped.load( std::memory_order_relaxed );
+}
+
 // *************************************************** //
 //
 // OS/API-specific methods.
@@ -1015,6 +1399,13 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
       continue;
     }
 
+    // Absolute time: CoreMIDI host time is the steady clock's time base
+    if ( data->absoluteTime && !continueSysex ) {
+      time = packet->timeStamp;
+      if ( time == 0 ) time = AudioGetCurrentHostTime();
+      message.time = AudioConvertHostTimeToNanos( time );
+    }
+
     // Calculate time stamp.
     if ( data->firstMessage ) {
       message.timeStamp = 0.0;
@@ -1048,8 +1439,7 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
       if ( !( data->ignoreFlags & 0x01 ) && !continueSysex ) {
         // If not a continuing sysex message, invoke the user callback function or queue the message.
         if ( data->usingCallback ) {
-          RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-          callback( message.timeStamp, &message.bytes, data->userData );
+          rtmidiInvokeCallback( data, message.timeStamp, message.time, &message.bytes );
         }
         else {
           // As long as we haven't reached our queue size limit, push the message.
@@ -1107,8 +1497,7 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
           if ( !continueSysex ) {
             // If not a continuing sysex message, invoke the user callback function or queue the message.
             if ( data->usingCallback ) {
-              RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-              callback( message.timeStamp, &message.bytes, data->userData );
+              rtmidiInvokeCallback( data, message.timeStamp, message.time, &message.bytes );
             }
             else {
               // As long as we haven't reached our queue size limit, push the message.
@@ -1763,6 +2152,7 @@ struct AlsaMidiData {
   pthread_t thread;
   pthread_t dummy_thread_id;
   snd_seq_real_time_t lastTime;
+  long long queueStart; // steady clock time when the input queue was started
   int queue_id; // an input queue is needed to get timestamped events
   int trigger_fds[2];
 };
@@ -1774,16 +2164,114 @@ struct AlsaMidiData {
 //  Class Definitions: MidiInAlsa
 //*********************************************************************//
 
+// Time in seconds since the previous event, from the ALSA real-time
+// stamps.  Using method from:
+// https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
+static double alsaEventDelta( AlsaMidiData *apiData, const snd_seq_event_t *ev )
+{
+  // Perform the carry for the later subtraction by updating y.
+  // Temp var y is timespec because computation requires signed types,
+  // while snd_seq_real_time_t has unsigned types.
+  const snd_seq_real_time_t &x( ev->time.time );
+  struct timespec y;
+  y.tv_nsec = apiData->lastTime.tv_nsec;
+  y.tv_sec = apiData->lastTime.tv_sec;
+  if ( x.tv_nsec < y.tv_nsec ) {
+      int nsec = (y.tv_nsec - (int)x.tv_nsec) / 1000000000 + 1;
+      y.tv_nsec -= 1000000000 * nsec;
+      y.tv_sec += nsec;
+  }
+  if ( x.tv_nsec - y.tv_nsec > 1000000000 ) {
+      int nsec = ((int)x.tv_nsec - y.tv_nsec) / 1000000000;
+      y.tv_nsec += 1000000000 * nsec;
+      y.tv_sec -= nsec;
+  }
+
+  // Compute the time difference.
+  double time = (int)x.tv_sec - y.tv_sec + ((int)x.tv_nsec - y.tv_nsec)*1e-9;
+
+  apiData->lastTime = ev->time.time;
+  return time;
+}
+
+// Absolute time of the event.  The input queue counts real time from
+// the moment it was started, so its stamps are offset by that moment.
+static long long alsaEventTime( AlsaMidiData *apiData, const snd_seq_event_t *ev )
+{
+#ifndef AVOID_TIMESTAMPING
+  return apiData->queueStart + ev->time.time.tv_sec * 1000000000LL + ev->time.time.tv_nsec;
+#else
+  (void) apiData;
+  (void) ev;
+  return rtmidiSteadyTime();
+#endif
+}
+
+// Channel messages are rebuilt straight from the event fields instead
+// of a round trip through the snd_midi_event coder.  Returns the number
+// of bytes written, or 0 for events the coder has to handle.
+static int alsaDecodeChannelEvent( const snd_seq_event_t *ev, unsigned char *bytes )
+{
+  switch ( ev->type ) {
+  case SND_SEQ_EVENT_NOTEON:
+  case SND_SEQ_EVENT_NOTEOFF:
+  case SND_SEQ_EVENT_KEYPRESS:
+    bytes[0] = ( ev->type == SND_SEQ_EVENT_NOTEON ? 0x90 : ev->type == SND_SEQ_EVENT_NOTEOFF ? 0x80 : 0xA0 )
+               | ( ev->data.note.channel & 0x0F );
+    bytes[1] = ev->data.note.note & 0x7F;
+    bytes[2] = ev->data.note.velocity & 0x7F;
+    return 3;
+
+  case SND_SEQ_EVENT_CONTROLLER:
+    bytes[0] = 0xB0 | ( ev->data.control.channel & 0x0F );
+    bytes[1] = ev->data.control.param & 0x7F;
+    bytes[2] = ev->data.control.value & 0x7F;
+    return 3;
+
+  case SND_SEQ_EVENT_PGMCHANGE:
+  case SND_SEQ_EVENT_CHANPRESS:
+    bytes[0] = ( ev->type == SND_SEQ_EVENT_PGMCHANGE ? 0xC0 : 0xD0 ) | ( ev->data.control.channel & 0x0F );
+    bytes[1] = ev->data.control.value & 0x7F;
+    return 2;
+
+  case SND_SEQ_EVENT_PITCHBEND: {
+    int value = ev->data.control.value + 8192;
+    if ( value < 0 ) value = 0;
+    if ( value > 16383 ) value = 16383;
+    bytes[0] = 0xE0 | ( ev->data.control.channel & 0x0F );
+    bytes[1] = value & 0x7F;
+    bytes[2] = ( value >> 7 ) & 0x7F;
+    return 3;
+  }
+  }
+  return 0;
+}
+
+static void alsaDeliver( MidiInApi::RtMidiInData *data, const unsigned char *bytes, size_t size,
+                         double timeStamp, long long time, std::vector<unsigned char> &callbackBytes )
+{
+  if ( data->usingCallback ) {
+    callbackBytes.assign( bytes, bytes + size );
+    rtmidiInvokeCallback( data, timeStamp, time, &callbackBytes );
+  }
+  else {
+    // As long as we haven't reached our queue size limit, push the message.
+    if ( !data->queue.push( bytes, size, timeStamp, time ) )
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+  }
+}
+
 static void *alsaMidiHandler( void *ptr )
 {
   MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
   AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
 
   long nBytes;
-  double time;
   bool continueSysex = false;
   bool doDecode = false;
   MidiInApi::MidiMessage message;
+  std::vector<unsigned char> callbackBytes;
+  unsigned char channelBytes[3];
   int poll_fd_count;
   struct pollfd *poll_fds;
 
@@ -1814,8 +2302,12 @@ static void *alsaMidiHandler( void *ptr )
 
   while ( data->doInput ) {
 
-    if ( snd_seq_event_input_pending( apiData->seq, 1 ) == 0 ) {
-      // No data pending
+    // The sequencer is opened non-blocking, so this drains everything
+    // that arrived since the last wakeup before we poll again.
+    result = snd_seq_event_input( apiData->seq, &ev );
+    if ( result == -EAGAIN ) {
+      // Publish what this wakeup queued with at most one reader wakeup
+      data->queue.endBatch();
       if ( poll( poll_fds, poll_fd_count, -1) >= 0 ) {
         if ( poll_fds[0].revents & POLLIN ) {
           bool dummy;
@@ -1825,18 +2317,30 @@ static void *alsaMidiHandler( void *ptr )
       }
       continue;
     }
-
-    // If here, there should be data.
-    result = snd_seq_event_input( apiData->seq, &ev );
-    if ( result == -ENOSPC ) {
+    else if ( result == -ENOSPC ) {
       std::cerr << "\nMidiInAlsa::alsaMidiHandler: MIDI input buffer overrun!\n\n";
       continue;
     }
-    else if ( result <= 0 ) {
+    else if ( result < 0 ) {
       std::cerr << "\nMidiInAlsa::alsaMidiHandler: unknown MIDI input error!\n";
       perror("System reports");
       continue;
     }
+    data->queue.beginBatch();
+
+    int channelSize = alsaDecodeChannelEvent( ev, channelBytes );
+    if ( channelSize > 0 ) {
+      // Never ignored, and independent of any SysEx being assembled
+      double timeStamp = alsaEventDelta( apiData, ev );
+      if ( data->firstMessage == true ) {
+        data->firstMessage = false;
+        timeStamp = 0.0;
+      }
+      long long time = data->absoluteTime ? alsaEventTime( apiData, ev ) : 0;
+      snd_seq_free_event( ev );
+      alsaDeliver( data, channelBytes, channelSize, timeStamp, time, callbackBytes );
+      continue;
+    }
 
     // This is a bit weird, but we now have to decode an ALSA MIDI
     // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
@@ -1914,46 +2418,17 @@ static void *alsaMidiHandler( void *ptr )
         continueSysex = ( ( ev->type == SND_SEQ_EVENT_SYSEX ) && ( message.bytes.back() != 0xF7 ) );
         if ( !continueSysex ) {
 
-          // Calculate the time stamp:
+          // Calculate the time stamp from the ALSA sequencer event time
+          // data (thanks to Pedro Lopez-Cabanillas!).
           message.timeStamp = 0.0;
-
-          // Method 1: Use the system time.
-          //(void)gettimeofday(&tv, (struct timezone *)NULL);
-          //time = (tv.tv_sec * 1000000) + tv.tv_usec;
-
-          // Method 2: Use the ALSA sequencer event time data.
-          // (thanks to Pedro Lopez-Cabanillas!).
-
-          // Using method from:
-          // https://www.gnu.org/software/libc/manual/html_node/Elapsed-Time.html
-
-          // Perform the carry for the later subtraction by updating y.
-          // Temp var y is timespec because computation requires signed types,
-          // while snd_seq_real_time_t has unsigned types.
-          snd_seq_real_time_t &x( ev->time.time );
-          struct timespec y;
-          y.tv_nsec = apiData->lastTime.tv_nsec;
-          y.tv_sec = apiData->lastTime.tv_sec;
-          if ( x.tv_nsec < y.tv_nsec ) {
-              int nsec = (y.tv_nsec - (int)x.tv_nsec) / 1000000000 + 1;
-              y.tv_nsec -= 1000000000 * nsec;
-              y.tv_sec += nsec;
-          }
-          if ( x.tv_nsec - y.tv_nsec > 1000000000 ) {
-              int nsec = ((int)x.tv_nsec - y.tv_nsec) / 1000000000;
-              y.tv_nsec += 1000000000 * nsec;
-              y.tv_sec -= nsec;
-          }
-
-          // Compute the time difference.
-          time = (int)x.tv_sec - y.tv_sec + ((int)x.tv_nsec - y.tv_nsec)*1e-9;
-
-          apiData->lastTime = ev->time.time;
+          double time = alsaEventDelta( apiData, ev );
 
           if ( data->firstMessage == true )
             data->firstMessage = false;
           else
             message.timeStamp = time;
+          if ( data->absoluteTime )
+            message.time = alsaEventTime( apiData, ev );
         }
         else {
 #if defined(__RTMIDI_DEBUG__)
@@ -1966,17 +2441,10 @@ static void *alsaMidiHandler( void *ptr )
     snd_seq_free_event( ev );
     if ( message.bytes.size() == 0 || continueSysex ) continue;
 
-    if ( data->usingCallback ) {
-      RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-      callback( message.timeStamp, &message.bytes, data->userData );
-    }
-    else {
-      // As long as we haven't reached our queue size limit, push the message.
-      if ( !data->queue.push( message ) )
-        std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
-    }
+    alsaDeliver( data, &message.bytes[0], message.bytes.size(), message.timeStamp, message.time, callbackBytes );
   }
 
+  data->queue.endBatch();
   if ( buffer ) free( buffer );
   snd_midi_event_free( apiData->coder );
   apiData->coder = 0;
@@ -2016,6 +2484,43 @@ MidiInAlsa :: ~MidiInAlsa()
   delete data;
 }
 
+void MidiInAlsa :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
+{
+  MidiInApi::ignoreTypes( midiSysex, midiTime, midiSense );
+  applyEventFilter();
+}
+
+// Mirror ignoreFlags in the client event filter so the kernel drops the
+// ignored types instead of waking the input thread for every clock tick.
+// The filter lists accepted types, so all others are added to it.  The
+// checks in alsaMidiHandler() stay in place for kernels without it.
+void MidiInAlsa :: applyEventFilter( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( data == 0 ) return;
+
+  unsigned char flags = inputData_.ignoreFlags;
+  snd_seq_client_info_t *info;
+  snd_seq_client_info_alloca( &info );
+  if ( snd_seq_get_client_info( data->seq, info ) < 0 ) return;
+
+  snd_seq_client_info_event_filter_clear( info );
+  if ( flags & 0x07 ) {
+    for ( int type = 0; type < 256; type++ ) {
+      bool ignored = ( ( flags & 0x01 ) && type == SND_SEQ_EVENT_SYSEX ) ||
+        ( ( flags & 0x02 ) && ( type == SND_SEQ_EVENT_QFRAME || type == SND_SEQ_EVENT_TICK ||
+                                type == SND_SEQ_EVENT_CLOCK ) ) ||
+        ( ( flags & 0x04 ) && type == SND_SEQ_EVENT_SENSING );
+      if ( !ignored ) snd_seq_client_info_event_filter_add( info, type );
+    }
+  }
+
+  if ( snd_seq_set_client_info( data->seq, info ) < 0 ) {
+    errorString_ = "MidiInAlsa::ignoreTypes: error setting the client event filter, filtering in user space only.";
+    error( RtMidiError::DEBUG_WARNING, errorString_ );
+  }
+}
+
 void MidiInAlsa :: initialize( const std::string& clientName )
 {
   // Set up the ALSA sequencer client.
@@ -2050,6 +2555,9 @@ void MidiInAlsa :: initialize( const std::string& clientName )
     return;
   }
 
+  // SysEx, timing and active sensing are ignored by default
+  applyEventFilter();
+
   // Create the input queue
 #ifndef AVOID_TIMESTAMPING
   data->queue_id = snd_seq_alloc_named_queue( seq, "RtMidi Queue" );
@@ -2221,6 +2729,7 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string &portNam
 #ifndef AVOID_TIMESTAMPING
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
+    data->queueStart = rtmidiSteadyTime();
 #endif
     // Start our MIDI input thread.
     pthread_attr_t attr;
@@ -2283,6 +2792,7 @@ void MidiInAlsa :: openVirtualPort( const std::string &portName )
 #ifndef AVOID_TIMESTAMPING
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
+    data->queueStart = rtmidiSteadyTime();
 #endif
     // Start our MIDI input thread.
     pthread_attr_t attr;
@@ -2332,6 +2842,7 @@ void MidiInAlsa :: closePort( void )
     (void) res;
     if ( !pthread_equal( data->thread, data->dummy_thread_id ) )
       pthread_join( data->thread, NULL );
+    data->thread = data->dummy_thread_id;
   }
 }
 
@@ -2679,6 +3190,7 @@ struct WinMidiData {
   HMIDIIN inHandle;    // Handle to Midi Input Device
   HMIDIOUT outHandle;  // Handle to Midi Output Device
   DWORD lastTime;
+  long long startTime; // steady clock time of midiInStart(), the origin of the driver time stamps
   MidiInApi::MidiMessage message;
   std::vector<LPMIDIHDR> sysexBuffer;
   CRITICAL_SECTION _mutex; // [Patrice] see https://groups.google.com/forum/#!topic/mididev/6OUjHutMpEo
@@ -2708,6 +3220,10 @@ static void CALLBACK midiInputCallback( HMIDIIN /*hmin*/,
   }
   else apiData->message.timeStamp = (double) ( timestamp - apiData->lastTime ) * 0.001;
 
+  // The driver stamps are milliseconds since midiInStart()
+  if ( data->absoluteTime )
+    apiData->message.time = apiData->startTime + timestamp * 1000000LL;
+
   if ( inputStatus == MIM_DATA ) { // Channel or system message
 
     // Make sure the first byte is a status byte.
@@ -2771,8 +3287,7 @@ static void CALLBACK midiInputCallback( HMIDIIN /*hmin*/,
   apiData->lastTime = timestamp;
 
   if ( data->usingCallback ) {
-    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-    callback( apiData->message.timeStamp, &apiData->message.bytes, data->userData );
+    rtmidiInvokeCallback( data, apiData->message.timeStamp, apiData->message.time, &apiData->message.bytes );
   }
   else {
     // As long as we haven't reached our queue size limit, push the message.
@@ -2888,6 +3403,7 @@ void MidiInWinMM :: openPort( unsigned int portNumber, const std::string &/*port
     }
   }
 
+  data->startTime = rtmidiSteadyTime();
   result = midiInStart( data->inHandle );
   if ( result != MMSYSERR_NOERROR ) {
     midiInClose( data->inHandle );
@@ -3623,6 +4139,10 @@ void UWPMidiClass::midi_in_callback(const MidiInPort&, const MidiMessageReceived
         message.timeStamp = sec.count();
     }
 
+    // The port time stamps have no fixed origin, use the time of arrival
+    if (input_data_->absoluteTime)
+        message.time = rtmidiSteadyTime();
+
     if (((input_data_->ignoreFlags & 0x01) &&
             (m.Type() == MidiMessageType::SystemExclusive || m.Type() == MidiMessageType::EndSystemExclusive)) ||
         ((input_data_->ignoreFlags & 0x02) &&
@@ -3643,7 +4163,7 @@ void UWPMidiClass::midi_in_callback(const MidiInPort&, const MidiMessageReceived
 
     if (input_data_->usingCallback)
     {
-        (input_data_->userCallback)(message.timeStamp, &message.bytes, input_data_->userData);
+        rtmidiInvokeCallback(input_data_, message.timeStamp, message.time, &message.bytes);
     }
     else
     {
@@ -3804,12 +4324,12 @@ std::string MidiInWinUWP::getPortName(unsigned int portNumber)
     return data->get_port_name(portNumber);
 }
 
-double MidiInWinUWP::getMessage(std::vector<unsigned char>* message)
+double MidiInWinUWP::getMessage(std::vector<unsigned char>* message, long long* time)
 {
     UWPMidiClass* data{ static_cast<UWPMidiClass*>(apiData_) };
     std::lock_guard<std::mutex> lock(data->mtx_queue_);
 
-    return MidiInApi::getMessage(message);
+    return MidiInApi::getMessage(message, time);
 }
 
 //*********************************************************************//
@@ -3997,90 +4517,192 @@ struct JackMidiData {
   sem_t sem_needpost;
 #endif
   MidiInApi :: RtMidiInData *rtMidiIn;
+  MidiOutApi :: RtMidiOutData *rtMidiOut;
+
+  // Output side
+  std::atomic<unsigned int> outQueued; // events in buff
+  unsigned int outCounted;             // events at the front of buff already counted as carried over
+
+  // Input side
+  jack_nframes_t lastFrame;
+  jack_ringbuffer_t *inBuff;        // raw events for the dispatcher, see setDeferredDispatch()
+  std::atomic<bool> dispatching;
+  std::atomic<unsigned int> inDropped;
+  pthread_t dispatcher;
+#ifdef HAVE_SEMAPHORE
+  sem_t sem_dispatch;
+#endif
   };
 
+// Header written before the bytes of every event in JackMidiData::inBuff
+struct JackInEvent {
+  jack_nframes_t frame;
+  jack_nframes_t size;
+};
+
 //*********************************************************************//
 //  API: JACK
 //  Class Definitions: MidiInJack
 //*********************************************************************//
 
-static int jackProcessIn( jack_nframes_t nframes, void *arg )
+// Time stamp, filter and deliver one event. Called from the process
+// callback, or from the dispatcher thread when dispatch is deferred.
+static void jackDeliver( JackMidiData *jData, const unsigned char *bytes, size_t size, jack_nframes_t frame )
 {
-  JackMidiData *jData = (JackMidiData *) arg;
   MidiInApi :: RtMidiInData *rtData = jData->rtMidiIn;
-  jack_midi_event_t event;
-  jack_time_t time;
-
-  // Is port created?
-  if ( jData->port == NULL ) return 0;
-
-  void *buff = jack_port_get_buffer( jData->port, nframes );
+  MidiInApi::MidiMessage& message = rtData->message;
   bool& continueSysex = rtData->continueSysex;
-  unsigned char& ignoreFlags = rtData->ignoreFlags;
+  unsigned char ignoreFlags = rtData->ignoreFlags;
 
-  // We have midi events in buffer
-  int evCount = jack_midi_get_event_count( buff );
-  for (int j = 0; j < evCount; j++) {
-    MidiInApi::MidiMessage& message = rtData->message;
-    jack_midi_event_get( &event, buff, j );
+  // Compute the delta time from the frame positions, which is sample
+  // accurate and independent of when the event is handled.
+  if ( rtData->firstMessage == true ) {
+    message.timeStamp = 0.0;
+    rtData->firstMessage = false;
+  } else
+    message.timeStamp = (jack_nframes_t) ( frame - jData->lastFrame ) / (double) jack_get_sample_rate( jData->client );
 
-    // Compute the delta time.
-    time = jack_get_time();
-    if ( rtData->firstMessage == true ) {
-      message.timeStamp = 0.0;
-      rtData->firstMessage = false;
-    } else
-      message.timeStamp = ( time - jData->lastTime ) * 0.000001;
+  jData->lastFrame = frame;
 
-    jData->lastTime = time;
+  // JACK time is in microseconds on the monotonic system clock
+  if ( rtData->absoluteTime )
+    message.time = (long long) jack_frames_to_time( jData->client, frame ) * 1000;
 
-    if ( !continueSysex )
-      message.bytes.clear();
+  if ( !continueSysex )
+    message.bytes.clear();
 
-    if ( !( ( continueSysex || event.buffer[0] == 0xF0 ) && ( ignoreFlags & 0x01 ) ) ) {
-      // Unless this is a (possibly continued) SysEx message and we're ignoring SysEx,
-      // copy the event buffer into the MIDI message struct.
-      for ( unsigned int i = 0; i < event.size; i++ )
-        message.bytes.push_back( event.buffer[i] );
-    }
+  if ( !( ( continueSysex || bytes[0] == 0xF0 ) && ( ignoreFlags & 0x01 ) ) ) {
+    // Unless this is a (possibly continued) SysEx message and we're ignoring SysEx,
+    // copy the event buffer into the MIDI message struct.
+    message.bytes.insert( message.bytes.end(), bytes, bytes + size );
+  }
 
-    switch ( event.buffer[0] ) {
-      case 0xF0:
-        // Start of a SysEx message
-        continueSysex = event.buffer[event.size - 1] != 0xF7;
-        if ( ignoreFlags & 0x01 ) continue;
-        break;
-      case 0xF1:
-      case 0xF8:
-        // MIDI Time Code or Timing Clock message
-        if ( ignoreFlags & 0x02 ) continue;
-        break;
-      case 0xFE:
-        // Active Sensing message
-        if ( ignoreFlags & 0x04 ) continue;
-        break;
-      default:
-        if ( continueSysex ) {
-          // Continuation of a SysEx message
-          continueSysex = event.buffer[event.size - 1] != 0xF7;
-          if ( ignoreFlags & 0x01 ) continue;
-        }
-        // All other MIDI messages
+  switch ( bytes[0] ) {
+    case 0xF0:
+      // Start of a SysEx message
+      continueSysex = bytes[size - 1] != 0xF7;
+      if ( ignoreFlags & 0x01 ) return;
+      break;
+    case 0xF1:
+    case 0xF8:
+      // MIDI Time Code or Timing Clock message
+      if ( ignoreFlags & 0x02 ) return;
+      break;
+    case 0xFE:
+      // Active Sensing message
+      if ( ignoreFlags & 0x04 ) return;
+      break;
+    default:
+      if ( continueSysex ) {
+        // Continuation of a SysEx message
+        continueSysex = bytes[size - 1] != 0xF7;
+        if ( ignoreFlags & 0x01 ) return;
+      }
+      // All other MIDI messages
+  }
+
+  if ( !continueSysex ) {
+    // If not a continuation of a SysEx message,
+    // invoke the user callback function or queue the message.
+    if ( rtData->usingCallback ) {
+      rtmidiInvokeCallback( rtData, message.timeStamp, message.time, &message.bytes );
     }
+    else {
+      // As long as we haven't reached our queue size limit, push the message.
+      if ( !rtData->queue.push( message ) )
+        std::cerr << "\nMidiInJack: message queue limit reached!!\n\n";
+    }
+  }
+}
 
-    if ( !continueSysex ) {
-      // If not a continuation of a SysEx message,
-      // invoke the user callback function or queue the message.
-      if ( rtData->usingCallback ) {
-        RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) rtData->userCallback;
-        callback( message.timeStamp, &message.bytes, rtData->userData );
-      }
-      else {
-        // As long as we haven't reached our queue size limit, push the message.
-        if ( !rtData->queue.push( message ) )
-          std::cerr << "\nMidiInJack: message queue limit reached!!\n\n";
-      }
+static int jackProcessIn( jack_nframes_t nframes, void *arg )
+{
+  JackMidiData *jData = (JackMidiData *) arg;
+  jack_midi_event_t event;
+
+  // Is port created?
+  if ( jData->port == NULL ) return 0;
+
+  void *buff = jack_port_get_buffer( jData->port, nframes );
+  jack_nframes_t cycleStart = jack_last_frame_time( jData->client );
+
+  // We have midi events in buffer
+  int evCount = jack_midi_get_event_count( buff );
+  if ( jData->inBuff == NULL ) {
+    for (int j = 0; j < evCount; j++) {
+      jack_midi_event_get( &event, buff, j );
+      if ( event.size > 0 )
+        jackDeliver( jData, event.buffer, event.size, cycleStart + event.time );
     }
+    return 0;
+  }
+
+  // Deferred dispatch: only copy the raw events into the preallocated
+  // ring. Nothing here allocates, locks or calls user code.
+  bool written = false;
+  for (int j = 0; j < evCount; j++) {
+    jack_midi_event_get( &event, buff, j );
+    if ( event.size == 0 ) continue;
+
+    JackInEvent header;
+    header.frame = cycleStart + event.time;
+    header.size = (jack_nframes_t) event.size;
+    if ( jack_ringbuffer_write_space( jData->inBuff ) < sizeof( header ) + event.size ) {
+      jData->inDropped.fetch_add( 1, std::memory_order_relaxed );
+      continue;
+    }
+    jack_ringbuffer_write( jData->inBuff, (const char *) &header, sizeof( header ) );
+    jack_ringbuffer_write( jData->inBuff, (const char *) event.buffer, event.size );
+    written = true;
+  }
+
+#ifdef HAVE_SEMAPHORE
+  if ( written )
+    sem_post( &jData->sem_dispatch );
+#else
+  (void) written;
+#endif
+
+  return 0;
+}
+
+// Dispatcher thread for deferred dispatch: reads the events copied by
+// jackProcessIn and delivers them outside the realtime thread.
+static void *jackDispatchIn( void *arg )
+{
+  JackMidiData *jData = (JackMidiData *) arg;
+  MidiInApi :: RtMidiInData *rtData = jData->rtMidiIn;
+  std::vector<unsigned char> bytes( 1024 );
+  JackInEvent header;
+
+  for (;;) {
+    rtData->queue.beginBatch();
+    for (;;) {
+      size_t available = jack_ringbuffer_read_space( jData->inBuff );
+      if ( available < sizeof( header ) ) break;
+      jack_ringbuffer_peek( jData->inBuff, (char *) &header, sizeof( header ) );
+      // The process thread writes the header and the bytes separately
+      if ( available < sizeof( header ) + header.size ) break;
+
+      jack_ringbuffer_read_advance( jData->inBuff, sizeof( header ) );
+      if ( bytes.size() < header.size )
+        bytes.resize( header.size );
+      jack_ringbuffer_read( jData->inBuff, (char *) &bytes[0], header.size );
+      jackDeliver( jData, &bytes[0], header.size, header.frame );
+    }
+    rtData->queue.endBatch();
+
+    unsigned int dropped = jData->inDropped.exchange( 0, std::memory_order_relaxed );
+    if ( dropped )
+      std::cerr << "\nMidiInJack: dispatch buffer full, " << dropped << " events dropped!!\n\n";
+
+    if ( !jData->dispatching.load() ) break;
+
+#ifdef HAVE_SEMAPHORE
+    sem_wait( &jData->sem_dispatch );
+#else
+    usleep( 1000 );
+#endif
   }
 
   return 0;
@@ -4098,8 +4720,13 @@ void MidiInJack :: initialize( const std::string& clientName )
   apiData_ = (void *) data;
 
   data->rtMidiIn = &inputData_;
+  data->rtMidiOut = NULL;
   data->port = NULL;
   data->client = NULL;
+  data->lastFrame = 0;
+  data->inBuff = NULL;
+  data->dispatching.store( false );
+  data->inDropped.store( 0 );
   this->clientName = clientName;
 
   connect();
@@ -4129,9 +4756,65 @@ MidiInJack :: ~MidiInJack()
 
   if ( data->client )
     jack_client_close( data->client );
+  // The process callback may use the ring until the client is closed
+  if ( data->inBuff )
+    jack_ringbuffer_free( data->inBuff );
   delete data;
 }
 
+void MidiInJack :: startDispatcher()
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  if ( !inputData_.deferDispatch || data->dispatching.load() )
+    return;
+
+  if ( data->inBuff == NULL ) {
+    data->inBuff = jack_ringbuffer_create( JACK_RINGBUFFER_SIZE );
+    if ( data->inBuff == NULL ) {
+      errorString_ = "MidiInJack::startDispatcher: JACK error creating ringbuffer";
+      error( RtMidiError::MEMORY_ERROR, errorString_ );
+      return;
+    }
+    jack_ringbuffer_mlock( data->inBuff );
+  }
+  else
+    jack_ringbuffer_reset( data->inBuff );
+
+#ifdef HAVE_SEMAPHORE
+  sem_init( &data->sem_dispatch, 0, 0 );
+#endif
+
+  data->dispatching.store( true );
+  if ( pthread_create( &data->dispatcher, NULL, jackDispatchIn, data ) ) {
+    data->dispatching.store( false );
+#ifdef HAVE_SEMAPHORE
+    sem_destroy( &data->sem_dispatch );
+#endif
+    // Without a dispatcher the events are delivered from the process callback
+    jack_ringbuffer_free( data->inBuff );
+    data->inBuff = NULL;
+    errorString_ = "MidiInJack::startDispatcher: error starting the dispatcher thread!";
+    error( RtMidiError::THREAD_ERROR, errorString_ );
+  }
+}
+
+void MidiInJack :: stopDispatcher()
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  if ( !data->dispatching.load() )
+    return;
+
+  // The dispatcher drains what is left in the ring before it exits
+  data->dispatching.store( false );
+#ifdef HAVE_SEMAPHORE
+  sem_post( &data->sem_dispatch );
+#endif
+  pthread_join( data->dispatcher, NULL );
+#ifdef HAVE_SEMAPHORE
+  sem_destroy( &data->sem_dispatch );
+#endif
+}
+
 void MidiInJack :: openPort( unsigned int portNumber, const std::string &portName )
 {
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
@@ -4139,9 +4822,11 @@ void MidiInJack :: openPort( unsigned int portNumber, const std::string &portNam
   connect();
 
   // Creating new port
-  if ( data->port == NULL )
+  if ( data->port == NULL ) {
+    startDispatcher();
     data->port = jack_port_register( data->client, portName.c_str(),
                                      JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0 );
+  }
 
   if ( data->port == NULL ) {
     errorString_ = "MidiInJack::openPort: JACK error creating port";
@@ -4163,9 +4848,11 @@ void MidiInJack :: openVirtualPort( const std::string &portName )
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
 
   connect();
-  if ( data->port == NULL )
+  if ( data->port == NULL ) {
+    startDispatcher();
     data->port = jack_port_register( data->client, portName.c_str(),
                                      JACK_DEFAULT_MIDI_TYPE, JackPortIsInput, 0 );
+  }
 
   if ( data->port == NULL ) {
     errorString_ = "MidiInJack::openVirtualPort: JACK error creating virtual port";
@@ -4234,6 +4921,7 @@ void MidiInJack :: closePort()
   if ( data->port == NULL ) return;
   jack_port_unregister( data->client, data->port );
   data->port = NULL;
+  stopDispatcher();
 
   connected_ = false;
 }
@@ -4265,6 +4953,7 @@ void MidiInJack :: setPortName( const std::string &portName )
 static int jackProcessOut( jack_nframes_t nframes, void *arg )
 {
   JackMidiData *data = (JackMidiData *) arg;
+  MidiOutApi :: RtMidiOutData *rtData = data->rtMidiOut;
   jack_midi_data_t *midiData;
   int space;
 
@@ -4274,15 +4963,49 @@ static int jackProcessOut( jack_nframes_t nframes, void *arg )
   void *buff = jack_port_get_buffer( data->port, nframes );
   jack_midi_clear_buffer( buff );
 
+  // Anything larger than an empty port buffer can ever hold has to be dropped.
+  size_t maxEventSize = jack_midi_max_event_size( buff );
+  unsigned int budget = rtData->eventBudget.load( std::memory_order_relaxed );
+  unsigned int written = 0;
+  bool deferred = false;
+
   while ( jack_ringbuffer_peek( data->buff, (char *) &space, sizeof( space ) ) == sizeof(space) &&
           jack_ringbuffer_read_space( data->buff ) >= sizeof(space) + space ) {
-    jack_ringbuffer_read_advance( data->buff, sizeof(space) );
+    if ( budget > 0 && written >= budget ) {
+      // Leave the rest queued for the next cycle.
+      deferred = true;
+      break;
+    }
 
-    midiData = jack_midi_event_reserve( buff, 0, space );
-    if ( midiData )
-        jack_ringbuffer_read( data->buff, (char *) midiData, (size_t) space );
-    else
-        jack_ringbuffer_read_advance( data->buff, (size_t) space );
+    if ( (size_t) space > maxEventSize ) {
+      jack_ringbuffer_read_advance( data->buff, sizeof(space) + space );
+      rtData->dropped.fetch_add( 1, std::memory_order_relaxed );
+    }
+    else {
+      midiData = jack_midi_event_reserve( buff, 0, space );
+      if ( midiData == NULL ) {
+        // The port buffer is full for this period, retry on the next one.
+        deferred = true;
+        break;
+      }
+
+      jack_ringbuffer_read_advance( data->buff, sizeof(space) );
+      jack_ringbuffer_read( data->buff, (char *) midiData, (size_t) space );
+      written++;
+    }
+
+    data->outQueued.fetch_sub( 1, std::memory_order_relaxed );
+    if ( data->outCounted > 0 ) data->outCounted--;
+  }
+
+  if ( deferred ) {
+    // Count every event left behind once, not again on each cycle it waits.
+    // Events queued while this cycle ran are included; they wait all the same.
+    unsigned int queued = data->outQueued.load( std::memory_order_relaxed );
+    if ( queued > data->outCounted ) {
+      rtData->carriedOver.fetch_add( queued - data->outCounted, std::memory_order_relaxed );
+      data->outCounted = queued;
+    }
   }
 
 #ifdef HAVE_SEMAPHORE
@@ -4303,8 +5026,11 @@ void MidiOutJack :: initialize( const std::string& clientName )
   JackMidiData *data = new JackMidiData;
   apiData_ = (void *) data;
 
+  data->rtMidiOut = &outputData_;
   data->port = NULL;
   data->client = NULL;
+  data->outQueued = 0;
+  data->outCounted = 0;
 #ifdef HAVE_SEMAPHORE
   sem_init( &data->sem_cleanup, 0, 0 );
   sem_init( &data->sem_needpost, 0, 0 );
@@ -4492,12 +5218,17 @@ void MidiOutJack :: sendMessage( const unsigned char *message, size_t size )
   int nBytes = static_cast<int>(size);
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
 
-  if ( size + sizeof(nBytes) > (size_t) data->buffMaxWrite )
+  if ( size + sizeof(nBytes) > (size_t) data->buffMaxWrite ) {
+      outputData_.dropped.fetch_add( 1, std::memory_order_relaxed );
       return;
+  }
 
   while ( jack_ringbuffer_write_space(data->buff) < sizeof(nBytes) + size )
       sched_yield();
 
+  // Counted first so the process callback never sees more events than queued
+  data->outQueued.fetch_add( 1, std::memory_order_relaxed );
+
   // Write full message to buffer
   jack_ringbuffer_write( data->buff, ( char * ) &nBytes, sizeof( nBytes ) );
   jack_ringbuffer_write( data->buff, ( const char * ) message, nBytes );
@@ -4641,9 +5372,10 @@ extern "C" void EMSCRIPTEN_KEEPALIVE rtmidi_onMidiMessageProc( MidiInApi::RtMidi
   message.bytes.resize(message.bytes.size() + length);
   memcpy(message.bytes.data(), inputBytes, length);
   // FIXME: handle timestamp
+  if ( data->absoluteTime )
+    message.time = rtmidiSteadyTime();
   if ( data->usingCallback ) {
-    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-    callback( message.timeStamp, &message.bytes, data->userData );
+    rtmidiInvokeCallback( data, message.timeStamp, message.time, &message.bytes );
   }
 }
 
@@ -5108,7 +5840,7 @@ void* MidiInAndroid :: pollMidi(void* context) {
   while (self->reading) {
     // AMidiOutputPort_receive is non-blocking, must poll with some sleep
     usleep(2000);
-    auto ignoreFlags = self->inputData_.ignoreFlags;
+    unsigned char ignoreFlags = self->inputData_.ignoreFlags;
     bool& continueSysex = self->inputData_.continueSysex;
 
     int32_t opcode;
@@ -5160,6 +5892,9 @@ void* MidiInAndroid :: pollMidi(void* context) {
       }
       self->lastTime = (timestamp * 0.000001);
 
+      // AMidi stamps are System.nanoTime(), i.e. CLOCK_MONOTONIC
+      if (self->inputData_.absoluteTime) message.time = timestamp;
+
       if (!continueSysex) message.bytes.clear();
 
       if ( !( ( continueSysex || incomingMessage[0] == 0xF0 ) && ( ignoreFlags & 0x01 ) ) ) {
@@ -5171,8 +5906,7 @@ void* MidiInAndroid :: pollMidi(void* context) {
 
       if (!continueSysex) {
         if (self->inputData_.usingCallback) {
-          auto callback = (RtMidiIn::RtMidiCallback) self->inputData_.userCallback;
-          callback(message.timeStamp, &message.bytes, self->inputData_.userData);
+          rtmidiInvokeCallback(&self->inputData_, message.timeStamp, message.time, &message.bytes);
         } else {
           if (!self->inputData_.queue.push(message))
             std::cerr << "\nMidiInAndroid: message queue limit reached!!\n\n";
@@ -5266,3 +6000,734 @@ void MidiOutAndroid :: sendMessage( const unsigned char *message, size_t size )
 }
 
 #endif  // __AMIDI__
+
+//*********************************************************************//
+//  API: Shared memory
+//
+//  A POSIX shared-memory ring for clients running on the same host.
+//  The writer publishes timestamped records into a single-producer,
+//  single-consumer ring and rings a futex doorbell, so a local
+//  synthesizer can consume events without going through a kernel MIDI
+//  stack.
+//*********************************************************************//
+
+#if defined(__UNIX_SHM__)
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SHM_RING_MAGIC 0x534d7452 // "RtMS"
+#define SHM_RING_VERSION 3
+#define SHM_RING_SIZE (1 << 20) // Default ring size in bytes, must be a power of two
+#define SHM_RECORD_HEADER 16    // 32-bit size, 32-bit padding, 64-bit timestamp
+#define SHM_WRAP_MARKER 0xFFFFFFFFu
+#define SHM_WRITE_TIMEOUT 100000000ull // ns a writer waits for room before dropping
+
+// Segments created by a virtual output are read by input ports and the
+// other way round, so each side only lists the segments it can connect to.
+#define SHM_OUTPUT_PREFIX "rtmidi-out-"
+#define SHM_INPUT_PREFIX "rtmidi-in-"
+
+// Header at the start of every segment, followed by the ring data. Each
+// record holds the message size, a CLOCK_MONOTONIC timestamp in
+// nanoseconds and the message bytes, padded to 8 bytes.  A record that
+// would not fit before the end of the ring is preceded by a wrap marker.
+// The ring has one reader and one writer; each claims its side by storing
+// its process id, and a side whose process has died can be claimed again.
+// The creator's process id tells a segment left behind by a process that
+// died without removing it, which is then neither listed nor in the way of
+// a new port with the same name.
+struct ShmRingHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t capacity;
+  std::atomic<uint32_t> doorbell;      // futex word, bumped on every publish
+  std::atomic<uint32_t> readerWaiting; // reader may be sleeping on the doorbell
+  std::atomic<uint32_t> readerPid;     // 0 when no reader is attached
+  std::atomic<uint32_t> writerPid;     // 0 when no writer is attached
+  std::atomic<uint32_t> creatorPid;    // process that created and will remove the segment
+  alignas(64) std::atomic<uint64_t> head; // advanced by the reader
+  alignas(64) std::atomic<uint64_t> tail; // advanced by the writer
+};
+
+struct ShmMidiData {
+  std::string name;
+  int fd;
+  size_t mapSize;
+  ShmRingHeader *ring;
+  unsigned char *ringData;
+  uint64_t capacity;  // private copy, the peer could change the shared one
+  bool owner;
+  bool claimed;       // holds the reader or writer side of the ring
+  bool stalled;       // writer timed out on a full ring and drops until there is room
+  pthread_t thread;
+  pthread_t dummy_thread_id;
+  uint64_t lastTime;
+};
+
+static uint64_t shmNow( void )
+{
+  struct timespec ts;
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+static size_t shmRecordSize( size_t size )
+{
+  return ( SHM_RECORD_HEADER + size + 7 ) & ~(size_t) 7;
+}
+
+static long shmFutex( std::atomic<uint32_t> *word, int op, uint32_t value, const struct timespec *timeout )
+{
+  // Not FUTEX_PRIVATE_FLAG: the word is shared with another process.
+  return syscall( SYS_futex, reinterpret_cast<uint32_t *>( word ), op, value, timeout, NULL, 0 );
+}
+
+static void shmRingDoorbell( ShmRingHeader *ring )
+{
+  ring->doorbell.fetch_add( 1 );
+  if ( ring->readerWaiting.load() )
+    shmFutex( &ring->doorbell, FUTEX_WAKE, INT_MAX, NULL );
+}
+
+static bool shmProcessAlive( uint32_t pid )
+{
+  // EPERM: the process exists but belongs to another user
+  return kill( (pid_t) pid, 0 ) == 0 || errno == EPERM;
+}
+
+// Claim the reader or writer side for this process, taking it over from a
+// process that has died without releasing it.
+static bool shmClaimSide( std::atomic<uint32_t> &side )
+{
+  uint32_t self = (uint32_t) getpid();
+  uint32_t holder = 0;
+  while ( !side.compare_exchange_strong( holder, self ) ) {
+    if ( holder != 0 && shmProcessAlive( holder ) )
+      return false;
+  }
+  return true;
+}
+
+static void shmReleaseSide( std::atomic<uint32_t> &side )
+{
+  uint32_t self = (uint32_t) getpid();
+  side.compare_exchange_strong( self, 0 );
+}
+
+// True when the segment's creator has died without removing it. With claim
+// set, only the one caller that takes the segment over gets true, so it
+// alone removes it. A segment that is still being set up is not stale.
+static bool shmSegmentStale( const std::string &path, bool claim )
+{
+  int fd = shm_open( path.c_str(), claim ? O_RDWR : O_RDONLY, 0 );
+  if ( fd < 0 ) return false;
+
+  bool stale = false;
+  struct stat st;
+  if ( fstat( fd, &st ) == 0 && (size_t) st.st_size >= sizeof( ShmRingHeader ) ) {
+    void *addr = mmap( NULL, sizeof( ShmRingHeader ), claim ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0 );
+    if ( addr != MAP_FAILED ) {
+      ShmRingHeader *ring = static_cast<ShmRingHeader *>( addr );
+      if ( ring->magic == SHM_RING_MAGIC && ring->version == SHM_RING_VERSION ) {
+        uint32_t creator = ring->creatorPid.load();
+        stale = creator != 0 && !shmProcessAlive( creator );
+        if ( stale && claim )
+          stale = ring->creatorPid.compare_exchange_strong( creator, 0 );
+      }
+      munmap( addr, sizeof( ShmRingHeader ) );
+    }
+  }
+  close( fd );
+  return stale;
+}
+
+// List the segment names (without prefix) a port of the given kind can connect to.
+static std::vector<std::string> shmListPorts( const char *prefix )
+{
+  std::vector<std::string> names;
+  DIR *dir = opendir( "/dev/shm" );
+  if ( dir == NULL ) return names;
+
+  size_t prefixLength = strlen( prefix );
+  struct dirent *entry;
+  while ( ( entry = readdir( dir ) ) != NULL ) {
+    if ( strncmp( entry->d_name, prefix, prefixLength ) == 0 &&
+         !shmSegmentStale( std::string( "/" ) + entry->d_name, false ) )
+      names.push_back( entry->d_name + prefixLength );
+  }
+  closedir( dir );
+
+  std::sort( names.begin(), names.end() );
+  return names;
+}
+
+// Create or attach to a segment. Returns an error description on failure.
+static std::string shmMapRing( ShmMidiData *data, const std::string &name, bool create )
+{
+  std::string path = "/" + name;
+  if ( create ) {
+    data->fd = shm_open( path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660 );
+    if ( data->fd < 0 && errno == EEXIST && shmSegmentStale( path, true ) ) {
+      // Left behind by a process that died: remove it and start afresh
+      shm_unlink( path.c_str() );
+      data->fd = shm_open( path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0660 );
+    }
+    if ( data->fd < 0 )
+      return errno == EEXIST ? "a port with this name already exists" : "error creating shared memory segment";
+    data->mapSize = sizeof( ShmRingHeader ) + SHM_RING_SIZE;
+    if ( ftruncate( data->fd, (off_t) data->mapSize ) < 0 ) {
+      close( data->fd );
+      shm_unlink( path.c_str() );
+      data->fd = -1;
+      return "error sizing shared memory segment";
+    }
+  }
+  else {
+    data->fd = shm_open( path.c_str(), O_RDWR, 0 );
+    if ( data->fd < 0 )
+      return "error opening shared memory segment";
+    struct stat st;
+    if ( fstat( data->fd, &st ) < 0 || (size_t) st.st_size < sizeof( ShmRingHeader ) ) {
+      close( data->fd );
+      data->fd = -1;
+      return "invalid shared memory segment";
+    }
+    data->mapSize = (size_t) st.st_size;
+  }
+
+  void *addr = mmap( NULL, data->mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, data->fd, 0 );
+  if ( addr == MAP_FAILED ) {
+    close( data->fd );
+    if ( create ) shm_unlink( path.c_str() );
+    data->fd = -1;
+    return "error mapping shared memory segment";
+  }
+
+  ShmRingHeader *ring = static_cast<ShmRingHeader *>( addr );
+  uint64_t capacity = SHM_RING_SIZE;
+  if ( create ) {
+    new ( ring ) ShmRingHeader();
+    ring->capacity = SHM_RING_SIZE;
+    ring->version = SHM_RING_VERSION;
+    ring->doorbell.store( 0 );
+    ring->readerWaiting.store( 0 );
+    ring->readerPid.store( 0 );
+    ring->writerPid.store( 0 );
+    ring->creatorPid.store( (uint32_t) getpid() );
+    ring->head.store( 0 );
+    ring->tail.store( 0 );
+    std::atomic_thread_fence( std::memory_order_release );
+    ring->magic = SHM_RING_MAGIC;
+  }
+  else {
+    // Read once; only this copy is used from here on
+    capacity = ring->capacity;
+    if ( ring->magic != SHM_RING_MAGIC || ring->version != SHM_RING_VERSION ||
+         capacity < 2 * SHM_RECORD_HEADER || sizeof( ShmRingHeader ) + capacity > data->mapSize ||
+         ( capacity & ( capacity - 1 ) ) != 0 ) {
+      munmap( addr, data->mapSize );
+      close( data->fd );
+      data->fd = -1;
+      return "shared memory segment has an incompatible layout";
+    }
+  }
+
+  data->name = name;
+  data->ring = ring;
+  data->ringData = reinterpret_cast<unsigned char *>( ring ) + sizeof( ShmRingHeader );
+  data->capacity = capacity;
+  data->owner = create;
+  data->claimed = false;
+  data->stalled = false;
+  return "";
+}
+
+static void shmUnmapRing( ShmMidiData *data )
+{
+  if ( data->ring == NULL ) return;
+  munmap( data->ring, data->mapSize );
+  close( data->fd );
+  if ( data->owner ) shm_unlink( ( "/" + data->name ).c_str() );
+  data->ring = NULL;
+  data->ringData = NULL;
+  data->fd = -1;
+  data->owner = false;
+}
+
+//*********************************************************************//
+//  API: Shared memory
+//  Class Definitions: MidiInShm
+//*********************************************************************//
+
+static void *shmMidiHandler( void *ptr )
+{
+  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
+  ShmMidiData *apiData = static_cast<ShmMidiData *> (data->apiData);
+  ShmRingHeader *ring = apiData->ring;
+  const uint64_t capacity = apiData->capacity;
+  const uint64_t mask = capacity - 1;
+  MidiInApi::MidiMessage message;
+  bool corrupt = false;
+
+  while ( data->doInput && !corrupt ) {
+    uint64_t head = ring->head.load( std::memory_order_relaxed );
+
+    // Announce we may sleep, then re-check so a publish cannot slip in between.
+    ring->readerWaiting.store( 1 );
+    uint32_t bell = ring->doorbell.load();
+    if ( head == ring->tail.load() ) {
+      // Wake up now and then to notice closePort() even without traffic
+      struct timespec timeout = { 0, 100000000 };
+      shmFutex( &ring->doorbell, FUTEX_WAIT, bell, &timeout );
+      continue;
+    }
+    ring->readerWaiting.store( 0, std::memory_order_relaxed );
+
+    uint64_t tail = ring->tail.load( std::memory_order_acquire );
+    while ( head != tail && data->doInput ) {
+      size_t offset = (size_t) ( head & mask );
+      uint32_t size;
+      if ( ( offset & 7 ) != 0 ) {
+        corrupt = true;
+        break;
+      }
+      memcpy( &size, apiData->ringData + offset, sizeof( size ) );
+      if ( size == SHM_WRAP_MARKER ) {
+        head += capacity - offset;
+        ring->head.store( head, std::memory_order_release );
+        continue;
+      }
+
+      // The segment is writable by other processes, so never trust a size
+      // that would reach past the end of the ring.
+      if ( offset + SHM_RECORD_HEADER > capacity || size > capacity - offset - SHM_RECORD_HEADER ) {
+        corrupt = true;
+        break;
+      }
+
+      uint64_t stamp;
+      memcpy( &stamp, apiData->ringData + offset + 8, sizeof( stamp ) );
+      const unsigned char *bytes = apiData->ringData + offset + SHM_RECORD_HEADER;
+
+      bool ignored = size == 0;
+      if ( !ignored ) {
+        switch ( bytes[0] ) {
+          case 0xF0:
+            ignored = ( data->ignoreFlags & 0x01 ) != 0;
+            break;
+          case 0xF1:
+          case 0xF8:
+            ignored = ( data->ignoreFlags & 0x02 ) != 0;
+            break;
+          case 0xFE:
+            ignored = ( data->ignoreFlags & 0x04 ) != 0;
+            break;
+        }
+      }
+
+      if ( !ignored ) {
+        message.bytes.assign( bytes, bytes + size );
+
+        // Compute the delta time.
+        if ( data->firstMessage == true ) {
+          message.timeStamp = 0.0;
+          data->firstMessage = false;
+        }
+        else
+          message.timeStamp = ( stamp - apiData->lastTime ) * 0.000000001;
+        apiData->lastTime = stamp;
+
+        // Writers stamp records with CLOCK_MONOTONIC
+        if ( data->absoluteTime )
+          message.time = (long long) stamp;
+
+        if ( data->usingCallback ) {
+          rtmidiInvokeCallback( data, message.timeStamp, message.time, &message.bytes );
+        }
+        else {
+          // As long as we haven't reached our queue size limit, push the message.
+          if ( !data->queue.push( message ) )
+            std::cerr << "\nMidiInShm: message queue limit reached!!\n\n";
+        }
+      }
+
+      // Hand the space back to the writer record by record
+      head += shmRecordSize( size );
+      ring->head.store( head, std::memory_order_release );
+    }
+  }
+
+  if ( corrupt )
+    std::cerr << "\nMidiInShm: invalid record in the ring, no longer reading from " << apiData->name << "!!\n\n";
+  ring->readerWaiting.store( 0 );
+  return 0;
+}
+
+MidiInShm :: MidiInShm( const std::string &clientName, unsigned int queueSizeLimit )
+  : MidiInApi( queueSizeLimit )
+{
+  MidiInShm::initialize( clientName );
+}
+
+MidiInShm :: ~MidiInShm()
+{
+  MidiInShm::closePort();
+  delete static_cast<ShmMidiData *> (apiData_);
+}
+
+void MidiInShm :: initialize( const std::string& /*clientName*/ )
+{
+  ShmMidiData *data = new ShmMidiData;
+  data->fd = -1;
+  data->mapSize = 0;
+  data->ring = NULL;
+  data->ringData = NULL;
+  data->capacity = 0;
+  data->owner = false;
+  data->claimed = false;
+  data->stalled = false;
+  data->dummy_thread_id = pthread_self();
+  data->thread = data->dummy_thread_id;
+  data->lastTime = 0;
+  apiData_ = (void *) data;
+  inputData_.apiData = (void *) data;
+}
+
+void MidiInShm :: startReader( void )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( !shmClaimSide( data->ring->readerPid ) ) {
+    shmUnmapRing( data );
+    errorString_ = "MidiInShm::openPort: the port already has a reader.";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+  data->claimed = true;
+
+  // Skip whatever was written before we attached
+  data->ring->head.store( data->ring->tail.load( std::memory_order_acquire ), std::memory_order_release );
+
+  pthread_attr_t attr;
+  pthread_attr_init( &attr );
+  pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_JOINABLE );
+  pthread_attr_setschedpolicy( &attr, SCHED_OTHER );
+
+  inputData_.doInput = true;
+  int err = pthread_create( &data->thread, &attr, shmMidiHandler, &inputData_ );
+  pthread_attr_destroy( &attr );
+  if ( err ) {
+    inputData_.doInput = false;
+    shmReleaseSide( data->ring->readerPid );
+    data->claimed = false;
+    shmUnmapRing( data );
+    errorString_ = "MidiInShm::openPort: error starting MIDI input thread!";
+    error( RtMidiError::THREAD_ERROR, errorString_ );
+  }
+}
+
+void MidiInShm :: openPort( unsigned int portNumber, const std::string &/*portName*/ )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring ) {
+    errorString_ = "MidiInShm::openPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  std::vector<std::string> ports = shmListPorts( SHM_OUTPUT_PREFIX );
+  if ( portNumber >= ports.size() ) {
+    std::ostringstream ost;
+    ost << "MidiInShm::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+
+  std::string result = shmMapRing( data, SHM_OUTPUT_PREFIX + ports[portNumber], false );
+  if ( !result.empty() ) {
+    errorString_ = "MidiInShm::openPort: " + result + ".";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+
+  startReader();
+  if ( inputData_.doInput ) connected_ = true;
+}
+
+void MidiInShm :: openVirtualPort( const std::string &portName )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring ) {
+    errorString_ = "MidiInShm::openVirtualPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  std::string result = shmMapRing( data, SHM_INPUT_PREFIX + portName, true );
+  if ( !result.empty() ) {
+    errorString_ = "MidiInShm::openVirtualPort: " + result + ".";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+
+  startReader();
+}
+
+void MidiInShm :: closePort( void )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring == NULL ) return;
+
+  if ( inputData_.doInput ) {
+    inputData_.doInput = false;
+    shmRingDoorbell( data->ring );
+    if ( !pthread_equal( data->thread, data->dummy_thread_id ) )
+      pthread_join( data->thread, NULL );
+    data->thread = data->dummy_thread_id;
+  }
+
+  if ( data->claimed ) shmReleaseSide( data->ring->readerPid );
+  data->claimed = false;
+  shmUnmapRing( data );
+  connected_ = false;
+}
+
+unsigned int MidiInShm :: getPortCount()
+{
+  return (unsigned int) shmListPorts( SHM_OUTPUT_PREFIX ).size();
+}
+
+std::string MidiInShm :: getPortName( unsigned int portNumber )
+{
+  std::vector<std::string> ports = shmListPorts( SHM_OUTPUT_PREFIX );
+  if ( portNumber >= ports.size() ) {
+    std::ostringstream ost;
+    ost << "MidiInShm::getPortName: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::WARNING, errorString_ );
+    return "";
+  }
+  return ports[portNumber];
+}
+
+void MidiInShm :: setClientName( const std::string& )
+{
+  errorString_ = "MidiInShm::setClientName: this function is not implemented for the UNIX_SHM API!";
+  error( RtMidiError::WARNING, errorString_ );
+}
+
+void MidiInShm :: setPortName( const std::string& )
+{
+  errorString_ = "MidiInShm::setPortName: this function is not implemented for the UNIX_SHM API!";
+  error( RtMidiError::WARNING, errorString_ );
+}
+
+//*********************************************************************//
+//  API: Shared memory
+//  Class Definitions: MidiOutShm
+//*********************************************************************//
+
+MidiOutShm :: MidiOutShm( const std::string &clientName ) : MidiOutApi()
+{
+  MidiOutShm::initialize( clientName );
+}
+
+MidiOutShm :: ~MidiOutShm()
+{
+  MidiOutShm::closePort();
+  delete static_cast<ShmMidiData *> (apiData_);
+}
+
+void MidiOutShm :: initialize( const std::string& /*clientName*/ )
+{
+  ShmMidiData *data = new ShmMidiData;
+  data->fd = -1;
+  data->mapSize = 0;
+  data->ring = NULL;
+  data->ringData = NULL;
+  data->capacity = 0;
+  data->owner = false;
+  data->claimed = false;
+  data->stalled = false;
+  data->lastTime = 0;
+  apiData_ = (void *) data;
+}
+
+void MidiOutShm :: openPort( unsigned int portNumber, const std::string &/*portName*/ )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring ) {
+    errorString_ = "MidiOutShm::openPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  std::vector<std::string> ports = shmListPorts( SHM_INPUT_PREFIX );
+  if ( portNumber >= ports.size() ) {
+    std::ostringstream ost;
+    ost << "MidiOutShm::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+
+  std::string result = shmMapRing( data, SHM_INPUT_PREFIX + ports[portNumber], false );
+  if ( !result.empty() ) {
+    errorString_ = "MidiOutShm::openPort: " + result + ".";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+
+  // Two writers would race on the tail and corrupt the ring
+  if ( !shmClaimSide( data->ring->writerPid ) ) {
+    shmUnmapRing( data );
+    errorString_ = "MidiOutShm::openPort: the port already has a writer.";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+  data->claimed = true;
+  connected_ = true;
+}
+
+void MidiOutShm :: openVirtualPort( const std::string &portName )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring ) {
+    errorString_ = "MidiOutShm::openVirtualPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  std::string result = shmMapRing( data, SHM_OUTPUT_PREFIX + portName, true );
+  if ( !result.empty() ) {
+    errorString_ = "MidiOutShm::openVirtualPort: " + result + ".";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+
+  shmClaimSide( data->ring->writerPid );
+  data->claimed = true;
+}
+
+void MidiOutShm :: closePort( void )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  if ( data->ring && data->claimed ) shmReleaseSide( data->ring->writerPid );
+  data->claimed = false;
+  shmUnmapRing( data );
+  connected_ = false;
+}
+
+unsigned int MidiOutShm :: getPortCount()
+{
+  return (unsigned int) shmListPorts( SHM_INPUT_PREFIX ).size();
+}
+
+std::string MidiOutShm :: getPortName( unsigned int portNumber )
+{
+  std::vector<std::string> ports = shmListPorts( SHM_INPUT_PREFIX );
+  if ( portNumber >= ports.size() ) {
+    std::ostringstream ost;
+    ost << "MidiOutShm::getPortName: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::WARNING, errorString_ );
+    return "";
+  }
+  return ports[portNumber];
+}
+
+void MidiOutShm :: setClientName( const std::string& )
+{
+  errorString_ = "MidiOutShm::setClientName: this function is not implemented for the UNIX_SHM API!";
+  error( RtMidiError::WARNING, errorString_ );
+}
+
+void MidiOutShm :: setPortName( const std::string& )
+{
+  errorString_ = "MidiOutShm::setPortName: this function is not implemented for the UNIX_SHM API!";
+  error( RtMidiError::WARNING, errorString_ );
+}
+
+void MidiOutShm :: sendMessage( const unsigned char *message, size_t size )
+{
+  ShmMidiData *data = static_cast<ShmMidiData *> (apiData_);
+  ShmRingHeader *ring = data->ring;
+  if ( ring == NULL ) {
+    errorString_ = "MidiOutShm::sendMessage: no open port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  const uint64_t capacity = data->capacity;
+  size_t recordSize = shmRecordSize( size );
+  if ( recordSize * 2 > capacity ) {
+    errorString_ = "MidiOutShm::sendMessage: message does not fit in the ring.";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  uint64_t tail = ring->tail.load( std::memory_order_relaxed );
+  size_t offset = (size_t) ( tail & ( capacity - 1 ) );
+  size_t contiguous = (size_t) capacity - offset;
+  size_t needed = contiguous < recordSize ? contiguous + recordSize : recordSize;
+
+  // Wait a while for the reader to make room. With nobody reading, or a
+  // reader that has stopped, drop the message.
+  uint64_t deadline = 0;
+  while ( tail + needed - ring->head.load( std::memory_order_acquire ) > capacity ) {
+    uint32_t reader = ring->readerPid.load( std::memory_order_relaxed );
+    if ( reader == 0 || data->stalled ) {
+      outputData_.dropped.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+
+    uint64_t now = shmNow();
+    if ( deadline == 0 )
+      deadline = now + SHM_WRITE_TIMEOUT;
+    else if ( now >= deadline ) {
+      // A reader that died cannot release its side; free it for the next one.
+      if ( !shmProcessAlive( reader ) )
+        ring->readerPid.compare_exchange_strong( reader, 0 );
+      data->stalled = true;
+      outputData_.dropped.fetch_add( 1, std::memory_order_relaxed );
+      return;
+    }
+    sched_yield();
+  }
+  data->stalled = false;
+
+  if ( contiguous < recordSize ) {
+    uint32_t marker = SHM_WRAP_MARKER;
+    memcpy( data->ringData + offset, &marker, sizeof( marker ) );
+    tail += contiguous;
+    offset = 0;
+  }
+
+  uint32_t nBytes = (uint32_t) size;
+  uint64_t stamp = shmNow();
+  unsigned char *record = data->ringData + offset;
+  memcpy( record, &nBytes, sizeof( nBytes ) );
+  memcpy( record + 8, &stamp, sizeof( stamp ) );
+  memcpy( record + SHM_RECORD_HEADER, message, size );
+
+  ring->tail.store( tail + recordSize, std::memory_order_release );
+  shmRingDoorbell( ring );
+}
+
+#endif  // __UNIX_SHM__
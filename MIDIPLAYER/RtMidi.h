@@ -77,6 +77,7 @@
                         "." RTMIDI_TOSTRING(RTMIDI_VERSION_PATCH)
 #endif
 
+#include <atomic>
 #include <exception>
 #include <iostream>
 #include <string>
@@ -163,6 +164,7 @@ class RTMIDI_DLL_PUBLIC RtMidi
     WEB_MIDI_API,   /*!< W3C Web MIDI API. */
     WINDOWS_UWP,    /*!< The Microsoft Universal Windows Platform MIDI API. */
     ANDROID_AMIDI,  /*!< Native Android MIDI API. */
+    UNIX_SHM,       /*!< POSIX shared-memory ring for clients on the same host. */
     NUM_APIS        /*!< Number of values in this enum. */
   };
 
@@ -272,12 +274,30 @@ class RTMIDI_DLL_PUBLIC RtMidi
 //
 // **************************************************************** //
 
+//! Position of one message in the buffer filled by RtMidiIn::getMessages().
+struct RtMidiMessageInfo {
+  double timeStamp; //!< Delta-time in seconds, as returned by getMessage()
+  long long time;   //!< Absolute time in nanoseconds, see RtMidiIn::setAbsoluteTimestamps()
+  size_t offset;    //!< Offset of the first byte in the caller's buffer
+  size_t size;      //!< Number of bytes in the message
+};
+
+//! Handle that becomes signaled when the input queue has messages.
+#if defined(_WIN32)
+typedef void *RtMidiWaitHandle; //!< Event HANDLE for WaitForSingleObject()
+#else
+typedef int RtMidiWaitHandle;   //!< File descriptor for poll() or select()
+#endif
+
 class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
 {
  public:
   //! User callback function type definition.
   typedef void (*RtMidiCallback)( double timeStamp, std::vector<unsigned char> *message, void *userData );
 
+  //! User callback function type receiving absolute time stamps in nanoseconds, see setAbsoluteTimestamps().
+  typedef void (*RtMidiTimedCallback)( long long time, std::vector<unsigned char> *message, void *userData );
+
   //! Default constructor that allows an optional api, client name and queue size.
   /*!
     An exception will be thrown if a MIDI system initialization
@@ -295,6 +315,7 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
                       will be used to group the ports that are created
                       by the application.
     \param queueSizeLimit An optional size of the MIDI input queue can be specified.
+                      Values above 2^31 are reduced to 2^31.
   */
   RtMidiIn( RtMidi::Api api=UNSPECIFIED,
             const std::string& clientName = "RtMidi Input Client",
@@ -341,6 +362,14 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
   */
   void setCallback( RtMidiCallback callback, void *userData = 0 );
 
+  //! Set a callback function that receives absolute time stamps instead of delta-times.
+  /*!
+    Works like setCallback() and enables setAbsoluteTimestamps().  The
+    first argument of the callback is the absolute time of the message
+    in nanoseconds.  cancelCallback() removes either kind of callback.
+  */
+  void setTimedCallback( RtMidiTimedCallback callback, void *userData = 0 );
+
   //! Cancel use of the current callback function (if one exists).
   /*!
     Subsequent incoming MIDI messages will be written to the queue
@@ -392,6 +421,39 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
   */
   double getMessage( std::vector<unsigned char> *message );
 
+  //! Like getMessage(), and also store the absolute time of the message in nanoseconds.
+  /*!
+    \e time is set to 0 when no message was available or absolute time
+    stamps are not enabled, see setAbsoluteTimestamps().
+  */
+  double getMessage( std::vector<unsigned char> *message, long long *time );
+
+  //! Copy as many queued messages as fit into a caller-owned buffer and return how many were copied.
+  /*!
+    Message bytes are packed back to back into \e buffer and
+    \e info receives the delta-time, offset and size of each one, in
+    queue order.  Copying stops after \e maxMessages messages or at
+    the first message that no longer fits; it stays queued for the
+    next call.  A message larger than the whole buffer could never be
+    delivered, so it is discarded with a warning.  Like getMessage(),
+    this returns immediately and cannot be used while a callback is
+    set.
+  */
+  unsigned int getMessages( unsigned char *buffer, size_t bufferSize,
+                            RtMidiMessageInfo *info, unsigned int maxMessages );
+
+  //! Return a handle that is signaled while messages are waiting in the input queue.
+  /*!
+    This lets a reader sleep in poll(), select() or
+    WaitForSingleObject() instead of calling getMessage() in a loop.
+    The handle is created on the first call, after which the input
+    thread signals it whenever the queue goes from empty to non-empty.
+    Call getMessages() once it is signaled: it resets the handle and
+    signals it again if it returns with messages still queued.  The
+    handle is owned by RtMidiIn and must not be closed.
+  */
+  RtMidiWaitHandle getWaitHandle( void );
+
   //! Set an error callback function to be invoked when an error has occurred.
   /*!
     The callback function will be called whenever an error has occurred. It is best
@@ -412,6 +474,32 @@ class RTMIDI_DLL_PUBLIC RtMidiIn : public RtMidi
   */
   virtual void setBufferSize( unsigned int size, unsigned int count );
 
+  //! Deliver input from a separate dispatcher thread instead of the backend's realtime thread.
+  /*!
+    When enabled, the realtime thread only copies raw events and their
+    frame times into a preallocated ring; a dispatcher thread then
+    assembles SysEx, applies ignoreTypes(), and invokes the callback or
+    fills the queue.  Use this when the callback may block or allocate.
+    Like setBufferSize(), this has no effect when called after
+    openPort().  Currently only honoured by the JACK API.
+  */
+  void setDeferredDispatch( bool enable = true );
+
+  //! Also stamp incoming messages with their absolute time.
+  /*!
+    The absolute time is given in nanoseconds on the clock behind
+    std::chrono::steady_clock (CLOCK_MONOTONIC on Linux,
+    QueryPerformanceCounter on Windows, the host time on macOS), so it
+    can be compared directly with an output timeline based on that
+    clock and does not accumulate rounding errors like summed
+    delta-times.  Where the backend provides its own time stamps they
+    are converted to that clock; otherwise the time the message was
+    received is used.  The time is available through
+    setTimedCallback(), getMessage( message, time ) and getMessages().
+    Delta-times keep working as before.  Disabled by default.
+  */
+  void setAbsoluteTimestamps( bool enable = true );
+
  protected:
   void openMidiApi( RtMidi::Api api, const std::string &clientName, unsigned int queueSizeLimit );
 };
@@ -510,6 +598,28 @@ class RTMIDI_DLL_PUBLIC RtMidiOut : public RtMidi
   */
   void sendMessage( const unsigned char *message, size_t size );
 
+  //! Limit the number of events the backend writes per processing cycle.
+  /*!
+      Events beyond the budget stay queued and are carried over to the
+      next cycle instead of being discarded.  A value of 0 (the default)
+      means no limit other than the capacity of the backend buffer.
+      Currently only honoured by the JACK API.
+  */
+  void setEventBudget( unsigned int eventsPerCycle );
+
+  //! Return the number of events that were deferred to a later processing cycle.
+  /*!
+      Every event is counted once, however many cycles it waits.
+  */
+  unsigned long long getCarriedOverCount( void ) const;
+
+  //! Return the number of events that were discarded by the backend.
+  /*!
+      An event is only dropped when it can never fit into the backend
+      buffer, e.g. a SysEx message larger than a JACK port buffer.
+  */
+  unsigned long long getDroppedCount( void ) const;
+
   //! Set an error callback function to be invoked when an error has occurred.
   /*!
     The callback function will be called whenever an error has occurred. It is best
@@ -576,10 +686,17 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
   MidiInApi( unsigned int queueSizeLimit );
   virtual ~MidiInApi( void );
   void setCallback( RtMidiIn::RtMidiCallback callback, void *userData );
+  void setTimedCallback( RtMidiIn::RtMidiTimedCallback callback, void *userData );
   void cancelCallback( void );
   virtual void ignoreTypes( bool midiSysex, bool midiTime, bool midiSense );
-  virtual double getMessage( std::vector<unsigned char> *message );
+  double getMessage( std::vector<unsigned char> *message ) { return getMessage( message, 0 ); }
+  virtual double getMessage( std::vector<unsigned char> *message, long long *time );
+  virtual unsigned int getMessages( unsigned char *buffer, size_t bufferSize,
+                                    RtMidiMessageInfo *info, unsigned int maxMessages );
+  virtual RtMidiWaitHandle getWaitHandle( void );
   virtual void setBufferSize( unsigned int size, unsigned int count );
+  void setDeferredDispatch( bool enable );
+  void setAbsoluteTimestamps( bool enable );
 
   // A MIDI structure used internally by the class to store incoming
   // messages.  Each message represents one and only one MIDI message.
@@ -589,23 +706,75 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
     //! Time in seconds elapsed since the previous message
     double timeStamp;
 
+    //! Absolute time in nanoseconds, only set with absolute time stamps enabled
+    long long time;
+
     // Default constructor.
     MidiMessage()
-      : bytes(0), timeStamp(0.0) {}
+      : bytes(0), timeStamp(0.0), time(0) {}
   };
 
+  // Single-producer/single-consumer ring between the input thread and
+  // the reader.  The input thread advances back, the reader advances
+  // front, and both are published with release/acquire ordering.  Short
+  // messages are stored inline in their slot; SysEx goes to a separate
+  // byte arena that is consumed in the same order as the slots, and only
+  // messages too large for the arena fall back to the heap.  After
+  // allocate(), push() does not allocate for anything that fits.
   struct MidiQueue {
-    unsigned int front;
-    unsigned int back;
-    unsigned int ringSize;
-    MidiMessage *ring;
+    enum { INLINE_BYTES = 16 };
+
+    struct Slot {
+      double timeStamp;
+      long long time;
+      unsigned int size;
+      unsigned int arenaEnd;   // arena position after this message
+      unsigned char *large;    // heap copy when the arena is too small
+      unsigned char bytes[INLINE_BYTES];
+    };
+
+    std::atomic<unsigned int> front;
+    std::atomic<unsigned int> back;
+    unsigned int ringSize;     // power of two, at least the limit
+    unsigned int ringMask;
+    unsigned int limit;        // maximum number of queued messages
+    Slot *ring;
+
+    std::atomic<unsigned int> arenaFront;
+    std::atomic<unsigned int> arenaBack;
+    unsigned int arenaSize;    // power of two
+    unsigned char *arena;
+
+    // Wakes a reader blocked on the wait handle, see getWaitHandle()
+    std::atomic<bool> notify;
+    RtMidiWaitHandle waitHandle;
+    int signalFd;              // write side of the handle on Unix
+    bool batching;             // input thread only, see beginBatch()
 
     // Default constructor.
     MidiQueue()
-      : front(0), back(0), ringSize(0), ring(0) {}
+      : front(0), back(0), ringSize(0), ringMask(0), limit(0), ring(0),
+        arenaFront(0), arenaBack(0), arenaSize(0), arena(0),
+        notify(false), waitHandle(0), signalFd(-1), batching(false) {}
+    ~MidiQueue();
+    void allocate( unsigned int queueSizeLimit );
     bool push( const MidiMessage& );
-    bool pop( std::vector<unsigned char>*, double* );
+    bool push( const unsigned char *bytes, size_t size, double timeStamp, long long time = 0 );
+    bool pop( std::vector<unsigned char>*, double*, long long *time = 0 );
+    // Copy the next message into buffer if it fits. Returns 1 when a
+    // message was copied, 0 when the queue is empty and -1 when the
+    // message needs more than capacity bytes (*size is set).
+    int popInto( unsigned char *buffer, size_t capacity, size_t *size, double *timeStamp, long long *time );
     unsigned int size( unsigned int *back=0, unsigned int *front=0 );
+    bool openWaitHandle( void );
+    void beginBatch( void );
+    void endBatch( void );
+    void signal( void );
+    void clearSignal( void );
+
+  private:
+    MidiQueue( const MidiQueue& );
+    MidiQueue& operator=( const MidiQueue& );
   };
 
   // The RtMidiInData structure is used to pass private class data to
@@ -613,21 +782,25 @@ class RTMIDI_DLL_PUBLIC MidiInApi : public MidiApi
   struct RtMidiInData {
     MidiQueue queue;
     MidiMessage message;
-    unsigned char ignoreFlags;
+    std::atomic<unsigned char> ignoreFlags; // changed live by ignoreTypes()
     bool doInput;
     bool firstMessage;
     void *apiData;
     bool usingCallback;
     RtMidiIn::RtMidiCallback userCallback;
+    RtMidiIn::RtMidiTimedCallback userTimedCallback;
     void *userData;
     bool continueSysex;
     unsigned int bufferSize;
     unsigned int bufferCount;
+    bool deferDispatch;
+    bool absoluteTime;          // fill MidiMessage::time
 
     // Default constructor.
     RtMidiInData()
       : ignoreFlags(7), doInput(false), firstMessage(true), apiData(0), usingCallback(false),
-        userCallback(0), userData(0), continueSysex(false), bufferSize(1024), bufferCount(4) {}
+        userCallback(0), userTimedCallback(0), userData(0), continueSysex(false), bufferSize(1024),
+        bufferCount(4), deferDispatch(false), absoluteTime(false) {}
   };
 
  protected:
@@ -641,6 +814,24 @@ class RTMIDI_DLL_PUBLIC MidiOutApi : public MidiApi
   MidiOutApi( void );
   virtual ~MidiOutApi( void );
   virtual void sendMessage( const unsigned char *message, size_t size ) = 0;
+  void setEventBudget( unsigned int eventsPerCycle );
+  unsigned long long getCarriedOverCount( void ) const;
+  unsigned long long getDroppedCount( void ) const;
+
+  // The RtMidiOutData structure is used to share the output limits and
+  // statistics with the MIDI output handling function or thread.
+  struct RtMidiOutData {
+    std::atomic<unsigned int> eventBudget;
+    std::atomic<unsigned long long> carriedOver;
+    std::atomic<unsigned long long> dropped;
+
+    // Default constructor.
+    RtMidiOutData()
+      : eventBudget(0), carriedOver(0), dropped(0) {}
+  };
+
+ protected:
+  RtMidiOutData outputData_;
 };
 
 // **************************************************************** //
@@ -655,13 +846,19 @@ inline void RtMidiIn :: openVirtualPort( const std::string &portName ) { rtapi_-
 inline void RtMidiIn :: closePort( void ) { rtapi_->closePort(); }
 inline bool RtMidiIn :: isPortOpen() const { return rtapi_->isPortOpen(); }
 inline void RtMidiIn :: setCallback( RtMidiCallback callback, void *userData ) { static_cast<MidiInApi *>(rtapi_)->setCallback( callback, userData ); }
+inline void RtMidiIn :: setTimedCallback( RtMidiTimedCallback callback, void *userData ) { static_cast<MidiInApi *>(rtapi_)->setTimedCallback( callback, userData ); }
 inline void RtMidiIn :: cancelCallback( void ) { static_cast<MidiInApi *>(rtapi_)->cancelCallback(); }
 inline unsigned int RtMidiIn :: getPortCount( void ) { return rtapi_->getPortCount(); }
 inline std::string RtMidiIn :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiIn :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense ) { static_cast<MidiInApi *>(rtapi_)->ignoreTypes( midiSysex, midiTime, midiSense ); }
-inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message ) { return static_cast<MidiInApi *>(rtapi_)->getMessage( message ); }
+inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message ) { return static_cast<MidiInApi *>(rtapi_)->getMessage( message, 0 ); }
+inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message, long long *time ) { return static_cast<MidiInApi *>(rtapi_)->getMessage( message, time ); }
+inline unsigned int RtMidiIn :: getMessages( unsigned char *buffer, size_t bufferSize, RtMidiMessageInfo *info, unsigned int maxMessages ) { return static_cast<MidiInApi *>(rtapi_)->getMessages( buffer, bufferSize, info, maxMessages ); }
+inline RtMidiWaitHandle RtMidiIn :: getWaitHandle( void ) { return static_cast<MidiInApi *>(rtapi_)->getWaitHandle(); }
 inline void RtMidiIn :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 inline void RtMidiIn :: setBufferSize( unsigned int size, unsigned int count ) { static_cast<MidiInApi *>(rtapi_)->setBufferSize(size, count); }
+inline void RtMidiIn :: setDeferredDispatch( bool enable ) { static_cast<MidiInApi *>(rtapi_)->setDeferredDispatch( enable ); }
+inline void RtMidiIn :: setAbsoluteTimestamps( bool enable ) { static_cast<MidiInApi *>(rtapi_)->setAbsoluteTimestamps( enable ); }
 
 inline RtMidi::Api RtMidiOut :: getCurrentApi( void ) throw() { return rtapi_->getCurrentApi(); }
 inline void RtMidiOut :: openPort( unsigned int portNumber, const std::string &portName ) { rtapi_->openPort( portNumber, portName ); }
@@ -672,6 +869,9 @@ inline unsigned int RtMidiOut :: getPortCount( void ) { return rtapi_->getPortCo
 inline std::string RtMidiOut :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiOut :: sendMessage( const std::vector<unsigned char> *message ) { static_cast<MidiOutApi *>(rtapi_)->sendMessage( &message->at(0), message->size() ); }
 inline void RtMidiOut :: sendMessage( const unsigned char *message, size_t size ) { static_cast<MidiOutApi *>(rtapi_)->sendMessage( message, size ); }
+inline void RtMidiOut :: setEventBudget( unsigned int eventsPerCycle ) { static_cast<MidiOutApi *>(rtapi_)->setEventBudget( eventsPerCycle ); }
+inline unsigned long long RtMidiOut :: getCarriedOverCount( void ) const { return static_cast<MidiOutApi *>(rtapi_)->getCarriedOverCount(); }
+inline unsigned long long RtMidiOut :: getDroppedCount( void ) const { return static_cast<MidiOutApi *>(rtapi_)->getDroppedCount(); }
 inline void RtMidiOut :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 #endif
@@ -0,0 +1,42 @@
+#include "RunningStatusEncoder.h"
+
+#include <cstring>
+
+size_t RunningStatusEncoder::encode(const unsigned char* message, size_t size, unsigned char* out) {
+    if (size == 0) return 0;
+    bytesIn_ += size;
+
+    unsigned char status = message[0];
+
+    if (status >= 0xF8) {
+        // Real-time messages may be interleaved anywhere and keep running status
+        std::memcpy(out, message, size);
+        bytesOut_ += size;
+        return size;
+    }
+
+    if (status >= 0xF0) {
+        // SysEx and system common messages cancel running status
+        runningStatus_ = 0;
+        std::memcpy(out, message, size);
+        bytesOut_ += size;
+        return size;
+    }
+
+    unsigned char velocity = size >= 3 ? message[2] : 0;
+    if (noteOffAsNoteOn_ && (status & 0xF0) == 0x80 && size >= 3) {
+        status = static_cast<unsigned char>(0x90 | (status & 0x0F));
+        velocity = 0;
+    }
+
+    size_t written = 0;
+    if (status != runningStatus_) {
+        out[written++] = status;
+        runningStatus_ = status;
+    }
+    if (size >= 2) out[written++] = message[1];
+    if (size >= 3) out[written++] = velocity;
+
+    bytesOut_ += written;
+    return written;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Turns complete MIDI messages into a byte stream that uses running status:
+// the status byte is omitted whenever it repeats the previous channel
+// message. Optionally note-offs are rewritten as note-ons with velocity 0,
+// which lets runs of note-ons and note-offs on the same channel share one
+// status byte. This is meant for byte-stream transports (DIN, serial, SMF
+// track data); message-based APIs such as WinMM add their own framing.
+class RunningStatusEncoder {
+public:
+    explicit RunningStatusEncoder(bool noteOffAsNoteOn = false)
+        : noteOffAsNoteOn_(noteOffAsNoteOn) {}
+
+    // Write the wire bytes of one message to out, which must have room for
+    // size bytes. Returns the number of bytes written.
+    size_t encode(const unsigned char* message, size_t size, unsigned char* out);
+
+    // Forget the current running status, e.g. after SysEx or a meta event
+    // written by the caller, or when the receiver may have lost sync.
+    void reset() { runningStatus_ = 0; }
+
+    void setNoteOffAsNoteOn(bool enabled) { noteOffAsNoteOn_ = enabled; }
+    bool getNoteOffAsNoteOn() const { return noteOffAsNoteOn_; }
+
+    uint64_t getBytesIn() const { return bytesIn_; }
+    uint64_t getBytesOut() const { return bytesOut_; }
+    uint64_t getBytesSaved() const { return bytesIn_ - bytesOut_; }
+
+private:
+    bool noteOffAsNoteOn_;
+    unsigned char runningStatus_ = 0;
+    uint64_t bytesIn_ = 0;
+    uint64_t bytesOut_ = 0;
+};
@@ -0,0 +1,139 @@
+#include "SendBench.h"
+
+#include <chrono>
+#include <memory>
+#include "LatencyHistogram.h"
+
+namespace {
+    const char* const kVirtualPortName = "MIDIPLAYER Send Bench";
+
+    struct Message {
+        const char* name;
+        std::vector<unsigned char> bytes;
+    };
+
+    // Nothing here makes a sound: a clock tick, zero channel pressure, a
+    // note-off and a SysEx with the non-commercial manufacturer ID
+    std::vector<Message> benchMessages() {
+        std::vector<unsigned char> sysex(64, 0x00);
+        sysex.front() = 0xF0;
+        sysex[1] = 0x7D;
+        sysex.back() = 0xF7;
+        return {
+            { "1 byte", { 0xF8 } },
+            { "2 bytes", { 0xD0, 0x00 } },
+            { "3 bytes", { 0x80, 0x3C, 0x00 } },
+            { "SysEx", sysex },
+        };
+    }
+
+    // Keeps the message of an error RtMidi would otherwise only print;
+    // backends without virtual ports merely warn and leave the port closed
+    void recordError(RtMidiError::Type, const std::string& message, void* userData) {
+        static_cast<std::string*>(userData)->assign(message);
+    }
+}
+
+SendBench::SendBench(const SendBenchSettings& settings)
+    : settings_(settings) {
+    if (settings_.count == 0) settings_.count = 1;
+    if (settings_.batch == 0) settings_.batch = 1;
+}
+
+void SendBench::run() {
+    results_.clear();
+    skipped_.clear();
+
+    if (settings_.api != RtMidi::UNSPECIFIED) {
+        measure(settings_.api);
+        return;
+    }
+    std::vector<RtMidi::Api> apis;
+    RtMidi::getCompiledApi(apis);
+    for (RtMidi::Api api : apis) measure(api);
+}
+
+void SendBench::measure(RtMidi::Api api) {
+    using Clock = std::chrono::steady_clock;
+
+    // Its ports accept every call and send nothing, so there is nothing to time
+    if (api == RtMidi::RTMIDI_DUMMY) {
+        skipped_.emplace_back(api, "sends nothing");
+        return;
+    }
+
+    std::unique_ptr<RtMidiOut> out;
+    std::string port;
+    try {
+        out.reset(new RtMidiOut(api, kVirtualPortName));
+        if (out->getCurrentApi() != api) {
+            skipped_.emplace_back(api, "not available");
+            return;
+        }
+        std::string openError;
+        out->setErrorCallback(recordError, &openError);
+        out->openVirtualPort(kVirtualPortName);
+        if (openError.empty()) {
+            port = kVirtualPortName;
+        }
+        else {
+            // No virtual ports on this backend
+            if (out->getPortCount() == 0) {
+                skipped_.emplace_back(api, "no virtual ports and no output port");
+                return;
+            }
+            openError.clear();
+            out->openPort(0);
+            if (!out->isPortOpen()) {
+                skipped_.emplace_back(api, openError.empty() ? "could not open port 0" : openError);
+                return;
+            }
+            port = out->getPortName(0);
+        }
+        // Errors while sending throw again
+        out->setErrorCallback();
+    }
+    catch (RtMidiError& error) {
+        skipped_.emplace_back(api, error.getMessage());
+        return;
+    }
+
+    for (const Message& message : benchMessages()) {
+        const unsigned char* bytes = message.bytes.data();
+        size_t size = message.bytes.size();
+
+        try {
+            // Single calls, each timed on its own
+            LatencyHistogram calls;
+            auto start = Clock::now();
+            for (unsigned int i = 0; i < settings_.count; i++) {
+                auto before = Clock::now();
+                out->sendMessage(bytes, size);
+                calls.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count());
+            }
+            double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            results_.push_back({ api, port, message.name, false, calls.getMean(),
+                elapsed > 0.0 ? settings_.count / elapsed : 0.0,
+                calls.getPercentile(50.0), calls.getPercentile(99.0) });
+
+            // Back-to-back runs, each timed as a whole
+            LatencyHistogram runs;
+            unsigned int sent = 0;
+            start = Clock::now();
+            while (sent < settings_.count) {
+                unsigned int run = settings_.count - sent < settings_.batch ? settings_.count - sent : settings_.batch;
+                auto before = Clock::now();
+                for (unsigned int i = 0; i < run; i++) out->sendMessage(bytes, size);
+                runs.record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - before).count() / run);
+                sent += run;
+            }
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+            results_.push_back({ api, port, message.name, true, elapsed * 1e9 / sent,
+                elapsed > 0.0 ? sent / elapsed : 0.0,
+                runs.getPercentile(50.0), runs.getPercentile(99.0) });
+        }
+        catch (RtMidiError& error) {
+            skipped_.emplace_back(api, std::string(message.name) + ": " + error.getMessage());
+        }
+    }
+}
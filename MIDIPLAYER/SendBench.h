@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "RtMidi.h"
+
+struct SendBenchSettings {
+    // UNSPECIFIED measures every API compiled in
+    RtMidi::Api api = RtMidi::UNSPECIFIED;
+    unsigned int count = 10000;
+    // Messages per timed run in the batched pass
+    unsigned int batch = 100;
+};
+
+struct SendBenchResult {
+    RtMidi::Api api;
+    std::string port;
+    std::string message;        // "1 byte", "2 bytes", "3 bytes" or "SysEx"
+    bool batched;
+    double nsPerMessage;
+    double messagesPerSecond;
+    // Spread of the single calls, or of the per-message cost of the runs
+    int64_t p50;
+    int64_t p99;
+};
+
+// Measures what RtMidiOut::sendMessage() costs on each backend, for the
+// message sizes the player sends. The single pass times every call on its
+// own, so it shows the spread; the batched pass times runs of back-to-back
+// calls, so it shows the throughput once caches and the driver are warm.
+// Virtual ports are used where the backend has them, so nothing reaches a
+// synth; otherwise the first port is used and the messages are chosen to
+// be silent. Backends that cannot be opened on this machine, and the dummy
+// backend, are skipped.
+class SendBench {
+public:
+    explicit SendBench(const SendBenchSettings& settings);
+
+    void run();
+
+    const std::vector<SendBenchResult>& getResults() const { return results_; }
+    // API and reason of every backend that was skipped
+    const std::vector<std::pair<RtMidi::Api, std::string>>& getSkipped() const { return skipped_; }
+
+private:
+    void measure(RtMidi::Api api);
+
+    SendBenchSettings settings_;
+    std::vector<SendBenchResult> results_;
+    std::vector<std::pair<RtMidi::Api, std::string>> skipped_;
+};
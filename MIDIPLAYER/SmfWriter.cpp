@@ -0,0 +1,161 @@
+#include "SmfWriter.h"
+
+#include <algorithm>
+
+namespace {
+    const size_t kBufferSize = 1 << 16;
+    const int kMaxTracks = 0xFFFF;
+    // Format and track count follow "MThd" and the header length
+    const std::streamoff kFormatPos = 8;
+
+    void putBigEndian(std::ofstream& file, uint32_t value, int bytes) {
+        for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8) {
+            file.put(static_cast<char>((value >> shift) & 0xFF));
+        }
+    }
+}
+
+bool SmfWriter::open(const std::string& path, int ticksPerQuarterNote, int trackCount) {
+    close();
+    file_.open(path, std::ios::binary | std::ios::trunc);
+    if (!file_) return false;
+
+    buffer_.resize(kBufferSize);
+    used_ = 0;
+    eventCount_ = 0;
+    finishedBytes_ = 0;
+    tracksStarted_ = 0;
+    invalid_ = false;
+    if (trackCount < 1) trackCount = 1;
+    if (trackCount > kMaxTracks) trackCount = kMaxTracks;
+    trackCount_ = trackCount;
+
+    file_.write("MThd", 4);
+    putBigEndian(file_, 6, 4);
+    putBigEndian(file_, trackCount > 1 ? 1 : 0, 2); // format
+    putBigEndian(file_, static_cast<uint32_t>(trackCount), 2);
+    putBigEndian(file_, static_cast<uint32_t>(ticksPerQuarterNote), 2);
+
+    startTrack();
+    return static_cast<bool>(file_);
+}
+
+void SmfWriter::nextTrack() {
+    if (!isOpen()) return;
+    if (tracksStarted_ == kMaxTracks) {
+        invalid_ = true;
+        return;
+    }
+    finishTrack();
+    startTrack();
+}
+
+void SmfWriter::startTrack() {
+    lastTick_ = 0;
+    trackBytes_ = 0;
+    tracksStarted_++;
+    encoder_.reset();
+
+    file_.write("MTrk", 4);
+    trackLengthPos_ = file_.tellp();
+    putBigEndian(file_, 0, 4); // patched by finishTrack()
+}
+
+void SmfWriter::finishTrack() {
+    const unsigned char endOfTrack[4] = { 0x00, 0xFF, 0x2F, 0x00 };
+    writeBytes(endOfTrack, sizeof(endOfTrack));
+    flushBuffer();
+
+    // A longer track cannot be described by its header
+    if (trackBytes_ > kMaxTrackBytes) invalid_ = true;
+
+    std::streamoff end = file_.tellp();
+    file_.seekp(trackLengthPos_);
+    putBigEndian(file_, static_cast<uint32_t>(trackBytes_), 4);
+    file_.seekp(end);
+    finishedBytes_ += trackBytes_;
+    trackBytes_ = 0;
+}
+
+void SmfWriter::writeEvent(int tick, const unsigned char* message, size_t size) {
+    if (!isOpen() || size == 0) return;
+    writeDelta(tick);
+
+    if (message[0] == 0xF0) {
+        // SysEx is stored as F0, the length of the rest, then the rest
+        encoder_.reset();
+        writeBytes(message, 1);
+        writeVarLen(static_cast<uint32_t>(size - 1));
+        writeBytes(message + 1, size - 1);
+    }
+    else {
+        unsigned char wire[3];
+        if (size > sizeof(wire)) size = sizeof(wire);
+        writeBytes(wire, encoder_.encode(message, size, wire));
+    }
+    eventCount_++;
+}
+
+void SmfWriter::writeMeta(int tick, unsigned char type, const unsigned char* data, size_t size) {
+    if (!isOpen()) return;
+    writeDelta(tick);
+
+    // Meta events cancel running status in a track
+    encoder_.reset();
+    const unsigned char header[2] = { 0xFF, type };
+    writeBytes(header, 2);
+    writeVarLen(static_cast<uint32_t>(size));
+    writeBytes(data, size);
+    eventCount_++;
+}
+
+bool SmfWriter::close() {
+    if (!isOpen()) return false;
+
+    finishTrack();
+    if (tracksStarted_ != trackCount_) {
+        // The caller started a different number of tracks than announced
+        file_.seekp(kFormatPos);
+        putBigEndian(file_, tracksStarted_ > 1 ? 1 : 0, 2);
+        putBigEndian(file_, static_cast<uint32_t>(tracksStarted_), 2);
+    }
+    bool ok = static_cast<bool>(file_) && !invalid_;
+    file_.close();
+    buffer_.clear();
+    buffer_.shrink_to_fit();
+    return ok;
+}
+
+void SmfWriter::writeDelta(int tick) {
+    int delta = std::max(0, tick - lastTick_);
+    lastTick_ = std::max(lastTick_, tick);
+    writeVarLen(static_cast<uint32_t>(delta));
+}
+
+void SmfWriter::writeVarLen(uint32_t value) {
+    unsigned char bytes[5];
+    int count = 0;
+    bytes[count++] = value & 0x7F;
+    while ((value >>= 7) != 0) {
+        bytes[count++] = static_cast<unsigned char>((value & 0x7F) | 0x80);
+    }
+    std::reverse(bytes, bytes + count);
+    writeBytes(bytes, count);
+}
+
+void SmfWriter::writeBytes(const unsigned char* data, size_t size) {
+    trackBytes_ += size;
+    while (size > 0) {
+        if (used_ == buffer_.size()) flushBuffer();
+        size_t chunk = std::min(size, buffer_.size() - used_);
+        std::copy(data, data + chunk, buffer_.begin() + used_);
+        used_ += chunk;
+        data += chunk;
+        size -= chunk;
+    }
+}
+
+void SmfWriter::flushBuffer() {
+    file_.write(reinterpret_cast<const char*>(buffer_.data()), used_);
+    used_ = 0;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "RunningStatusEncoder.h"
+
+// Writes a Standard MIDI File one event at a time. Events go through a
+// fixed-size buffer straight to disk, so the size of the output never
+// depends on memory; each track length is patched in when the track ends.
+// One track gives a format 0 file, more give format 1 with the tracks
+// written one after another. A track holds at most kMaxTrackBytes, the
+// largest length its header can store.
+// Channel messages use running status, with note-offs written as note-ons
+// with velocity 0 to keep the runs long.
+class SmfWriter {
+public:
+    static constexpr uint64_t kMaxTrackBytes = 0xFFFFFFFF;
+
+    SmfWriter() = default;
+    ~SmfWriter() { close(); }
+
+    SmfWriter(const SmfWriter&) = delete;
+    SmfWriter& operator=(const SmfWriter&) = delete;
+
+    bool open(const std::string& path, int ticksPerQuarterNote, int trackCount = 1);
+
+    // End the current track and start the next; call it trackCount - 1 times.
+    // Calling it more often adds tracks, and the header is updated on close,
+    // up to the 65535 tracks a file can hold.
+    void nextTrack();
+
+    // Ticks are absolute within a track and must not decrease between calls
+    void writeEvent(int tick, const unsigned char* message, size_t size);
+    void writeMeta(int tick, unsigned char type, const unsigned char* data, size_t size);
+
+    // Write the end of track and the final track length. Returns false if
+    // anything failed to reach the disk, or a track grew past kMaxTrackBytes
+    // or the track limit and the file is not valid.
+    bool close();
+
+    bool isOpen() const { return file_.is_open(); }
+    uint64_t getEventCount() const { return eventCount_; }
+    uint64_t getTrackBytes() const { return trackBytes_; }
+    uint64_t getBytesWritten() const { return finishedBytes_ + trackBytes_; }
+
+private:
+    void startTrack();
+    void finishTrack();
+    void writeDelta(int tick);
+    void writeVarLen(uint32_t value);
+    void writeBytes(const unsigned char* data, size_t size);
+    void flushBuffer();
+
+    std::ofstream file_;
+    std::vector<unsigned char> buffer_;
+    size_t used_ = 0;
+    std::streamoff trackLengthPos_ = 0;
+    int lastTick_ = 0;
+    int trackCount_ = 0;
+    int tracksStarted_ = 0;
+    uint64_t eventCount_ = 0;
+    uint64_t trackBytes_ = 0;
+    uint64_t finishedBytes_ = 0;
+    bool invalid_ = false;
+    RunningStatusEncoder encoder_{ true };
+};
@@ -0,0 +1,108 @@
+#include "Tracer.h"
+
+#ifdef MIDIPLAYER_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+    // Records per thread; 32 bytes each, 2 MiB per traced thread
+    const size_t kRingSize = 1 << 16;
+
+    struct Record {
+        const char* name;
+        int64_t time;   // Nanoseconds since the first record of the process
+        char phase;     // 'B', 'E' or 'i' as in the trace format
+    };
+
+    struct ThreadRing {
+        int id = 0;
+        const char* name = nullptr;
+        std::unique_ptr<Record[]> records{ new Record[kRingSize] };
+        std::atomic<uint64_t> head{ 0 };
+        uint64_t dumped = 0;
+    };
+
+    // Rings outlive their threads so a dump still finds what they recorded
+    std::mutex ringsMtx;
+    std::vector<std::unique_ptr<ThreadRing>> rings;
+    thread_local ThreadRing* threadRing = nullptr;
+
+    const std::chrono::steady_clock::time_point origin = std::chrono::steady_clock::now();
+
+    ThreadRing& currentRing() {
+        if (!threadRing) {
+            std::lock_guard<std::mutex> lock(ringsMtx);
+            rings.emplace_back(new ThreadRing());
+            threadRing = rings.back().get();
+            threadRing->id = static_cast<int>(rings.size());
+        }
+        return *threadRing;
+    }
+
+    void record(const char* name, char phase) {
+        ThreadRing& ring = currentRing();
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        Record& slot = ring.records[head & (kRingSize - 1)];
+        slot.name = name;
+        slot.time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - origin).count();
+        slot.phase = phase;
+        ring.head.store(head + 1, std::memory_order_release);
+    }
+}
+
+void Tracer::begin(const char* name) {
+    record(name, 'B');
+}
+
+void Tracer::end(const char* name) {
+    record(name, 'E');
+}
+
+void Tracer::instant(const char* name) {
+    record(name, 'i');
+}
+
+void Tracer::setThreadName(const char* name) {
+    currentRing().name = name;
+}
+
+bool Tracer::dump(const std::string& path) {
+    std::ofstream out(path);
+    if (!out) return false;
+
+    std::lock_guard<std::mutex> lock(ringsMtx);
+    out << "{\"traceEvents\":[\n";
+    bool first = true;
+    for (auto& ring : rings) {
+        if (ring->name) {
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+                << ring->id << ",\"args\":{\"name\":\"" << ring->name << "\"}}";
+            first = false;
+        }
+
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+        uint64_t start = ring->dumped;
+        if (head - start > kRingSize) start = head - kRingSize;
+        for (uint64_t i = start; i < head; i++) {
+            const Record& slot = ring->records[i & (kRingSize - 1)];
+            out << (first ? "" : ",\n") << "{\"name\":\"" << slot.name << "\",\"ph\":\"" << slot.phase
+                << "\",\"pid\":1,\"tid\":" << ring->id << ",\"ts\":" << slot.time / 1000
+                << "." << (slot.time % 1000) / 100 << (slot.time % 100) / 10 << slot.time % 10;
+            if (slot.phase == 'i') out << ",\"s\":\"t\"";
+            out << "}";
+            first = false;
+        }
+        ring->dumped = head;
+    }
+    out << "\n]}\n";
+    return out.good();
+}
+
+#endif
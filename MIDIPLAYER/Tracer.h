@@ -0,0 +1,59 @@
+#pragma once
+
+// Timeline of what the player threads do, written as Chrome trace JSON that
+// chrome://tracing and ui.perfetto.dev open. Build with MIDIPLAYER_TRACE
+// defined to enable it; otherwise every TRACE_ macro expands to nothing and
+// the tracer is not compiled at all.
+//
+// Every thread records into its own ring of fixed-size records, so tracing
+// takes no lock and allocates nothing after the first record of a thread.
+// When a ring is full the oldest records are overwritten. Names must be
+// string literals, only the pointer is stored.
+
+#ifdef MIDIPLAYER_TRACE
+
+#include <cstddef>
+#include <string>
+
+class Tracer {
+public:
+    static void begin(const char* name);
+    static void end(const char* name);
+    static void instant(const char* name);
+    static void setThreadName(const char* name);
+
+    // Write everything recorded since the previous dump. Call it while the
+    // traced threads are idle; a record written during the dump may be torn.
+    static bool dump(const std::string& path);
+};
+
+// Begin and end records around a scope
+class TraceScope {
+public:
+    explicit TraceScope(const char* name) : name_(name) { Tracer::begin(name_); }
+    ~TraceScope() { Tracer::end(name_); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* name_;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+#define TRACE_BEGIN(name) Tracer::begin(name)
+#define TRACE_END(name) Tracer::end(name)
+#define TRACE_INSTANT(name) Tracer::instant(name)
+#define TRACE_THREAD_NAME(name) Tracer::setThreadName(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void)0)
+#define TRACE_BEGIN(name) ((void)0)
+#define TRACE_END(name) ((void)0)
+#define TRACE_INSTANT(name) ((void)0)
+#define TRACE_THREAD_NAME(name) ((void)0)
+
+#endif
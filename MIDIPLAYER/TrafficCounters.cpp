@@ -0,0 +1,103 @@
+#include "TrafficCounters.h"
+
+#include <cstring>
+
+TrafficCounters::TrafficCounters() {
+    std::memset(keyDepth_, 0, sizeof(keyDepth_));
+}
+
+void TrafficCounters::reset(size_t trackCount) {
+    for (Lane& lane : channels_) {
+        lane.noteOns.store(0, std::memory_order_relaxed);
+        lane.bytes.store(0, std::memory_order_relaxed);
+        lane.held.store(0, std::memory_order_relaxed);
+        lane.peakHeld.store(0, std::memory_order_relaxed);
+    }
+    tracks_.reset(trackCount > 0 ? new Lane[trackCount] : nullptr);
+    trackCount_ = trackCount;
+    std::memset(keyDepth_, 0, sizeof(keyDepth_));
+}
+
+void TrafficCounters::count(int track, const unsigned char* message, size_t size) {
+    if (size == 0 || message[0] < 0x80 || message[0] >= 0xF0) return;
+
+    int channel = message[0] & 0x0F;
+    Lane* trackLane = track >= 0 && static_cast<size_t>(track) < trackCount_ ? &tracks_[track] : nullptr;
+    add(channels_[channel].bytes, size);
+    if (trackLane) add(trackLane->bytes, size);
+
+    int type = message[0] & 0xF0;
+    if (size < 3 || (type != 0x80 && type != 0x90)) return;
+
+    unsigned char& depth = keyDepth_[channel][message[1] & 0x7F];
+    if (type == 0x90 && message[2] > 0) {
+        add(channels_[channel].noteOns, 1);
+        if (depth == 0) noteOn(channels_[channel]);
+        if (depth < 0xFF) depth++;
+        if (trackLane) {
+            add(trackLane->noteOns, 1);
+            noteOn(*trackLane);
+        }
+    }
+    else {
+        if (depth > 0 && --depth == 0) noteOff(channels_[channel]);
+        if (trackLane) noteOff(*trackLane);
+    }
+}
+
+void TrafficCounters::writeJson(std::ostream& out) const {
+    auto writeLane = [&out](const char* key, size_t index, const LaneSnapshot& lane) {
+        out << "{\"" << key << "\":" << index
+            << ",\"noteOns\":" << lane.noteOns
+            << ",\"bytes\":" << lane.bytes
+            << ",\"held\":" << lane.held
+            << ",\"peakHeld\":" << lane.peakHeld << "}";
+    };
+
+    out << "{\"channels\":[";
+    bool first = true;
+    for (int i = 0; i < 16; i++) {
+        LaneSnapshot lane = channel(i);
+        if (lane.bytes == 0) continue;
+        if (!first) out << ",";
+        writeLane("channel", i + 1, lane);
+        first = false;
+    }
+    out << "],\"tracks\":[";
+    first = true;
+    for (size_t i = 0; i < trackCount_; i++) {
+        LaneSnapshot lane = track(i);
+        if (lane.bytes == 0) continue;
+        if (!first) out << ",";
+        writeLane("track", i, lane);
+        first = false;
+    }
+    out << "]}\n";
+}
+
+LaneSnapshot TrafficCounters::read(const Lane& lane) {
+    LaneSnapshot snapshot;
+    snapshot.noteOns = lane.noteOns.load(std::memory_order_relaxed);
+    snapshot.bytes = lane.bytes.load(std::memory_order_relaxed);
+    snapshot.held = lane.held.load(std::memory_order_relaxed);
+    snapshot.peakHeld = lane.peakHeld.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void TrafficCounters::add(std::atomic<uint64_t>& counter, uint64_t value) {
+    // Single writer: a load and a store are enough, no locked instructions
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void TrafficCounters::noteOn(Lane& lane) {
+    int held = lane.held.load(std::memory_order_relaxed) + 1;
+    lane.held.store(held, std::memory_order_relaxed);
+    if (held > lane.peakHeld.load(std::memory_order_relaxed)) {
+        lane.peakHeld.store(held, std::memory_order_relaxed);
+    }
+}
+
+void TrafficCounters::noteOff(Lane& lane) {
+    int held = lane.held.load(std::memory_order_relaxed);
+    if (held > 0) lane.held.store(held - 1, std::memory_order_relaxed);
+}
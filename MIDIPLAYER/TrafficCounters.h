@@ -0,0 +1,67 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+
+// Totals of one channel or track
+struct LaneSnapshot {
+    uint64_t noteOns = 0;
+    uint64_t bytes = 0;
+    int held = 0;       // Notes currently sounding
+    int peakHeld = 0;
+};
+
+// Note-on, polyphony and byte counters of everything the scheduler submits,
+// per channel and optionally per track, so a choking output can be traced
+// to the part of the file that floods it. Only the scheduler thread counts;
+// every lane sits on its own cache line and is updated with plain relaxed
+// stores, so counting costs no locked instructions and readers on other
+// threads never bounce the line the scheduler is writing.
+//
+// Channel polyphony follows every key, so retriggered notes are held once.
+// Track polyphony only balances note-ons against note-offs.
+class TrafficCounters {
+public:
+    TrafficCounters();
+
+    TrafficCounters(const TrafficCounters&) = delete;
+    TrafficCounters& operator=(const TrafficCounters&) = delete;
+
+    // Clears the counters. Track counters are kept for the first trackCount
+    // tracks, 0 disables them. Not safe while anyone reads or counts.
+    void reset(size_t trackCount);
+
+    // Scheduler thread only
+    void count(int track, const unsigned char* message, size_t size);
+
+    // Any thread
+    LaneSnapshot channel(int channel) const { return read(channels_[channel]); }
+    LaneSnapshot track(size_t track) const { return read(tracks_[track]); }
+    size_t getTrackCount() const { return trackCount_; }
+
+    // Every channel and every track that sent anything, as one JSON object
+    void writeJson(std::ostream& out) const;
+
+private:
+    struct alignas(64) Lane {
+        std::atomic<uint64_t> noteOns{ 0 };
+        std::atomic<uint64_t> bytes{ 0 };
+        std::atomic<int> held{ 0 };
+        std::atomic<int> peakHeld{ 0 };
+    };
+
+    static LaneSnapshot read(const Lane& lane);
+    static void add(std::atomic<uint64_t>& counter, uint64_t value);
+    static void noteOn(Lane& lane);
+    static void noteOff(Lane& lane);
+
+    Lane channels_[16];
+    std::unique_ptr<Lane[]> tracks_;
+    size_t trackCount_ = 0;
+
+    // Scheduler-private: how often each key of each channel is sounding
+    unsigned char keyDepth_[16][128];
+};